@@ -5,18 +5,110 @@
 #include <time.h>
 #include "smm.h"
 
-int main(void){
+static void usage(const char *prog){
+    fprintf(stderr, "usage: %s [--cdc SOCKET_PATH] [--replicate SOCKET_PATH | --replica-of SOCKET_PATH]\n"
+                    "       [--delivery-ring SHM_NAME] [--handoff SHM_NAME] [--user-store FILE]\n"
+                    "       [--post-store DIR] [--batch FILE] [--trace FILE]\n"
+                    "       %s --bench btree|output|names|reorder|analytics|roaring|check [N]\n"
+                    "       %s --delivery-worker SHM_NAME\n"
+                    "       %s --shard SOCKET_PATH\n"
+                    "       %s --router SHARD_PATH[,SHARD_PATH...]\n", prog, prog, prog, prog, prog);
+}
+
+int main(int argc, char **argv){
     App app;
     app_init(&app);
+    const char *handoff = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--cdc") == 0 && i+1 < argc) {
+            if (!cdc_open(&app.cdc, argv[++i])) {
+                fprintf(stderr, "Cannot open CDC socket %s\n", argv[i]);
+                app_free(&app); return 1;
+            }
+        } else if (strcmp(argv[i], "--replicate") == 0 && i+1 < argc) {
+            if (!repl_listen(&app.cdc, argv[++i])) {
+                fprintf(stderr, "Cannot open replication socket %s\n", argv[i]);
+                app_free(&app); return 1;
+            }
+        } else if (strcmp(argv[i], "--replica-of") == 0 && i+1 < argc) {
+            if (!replica_connect(&app, argv[++i])) {
+                fprintf(stderr, "Cannot reach leader at %s\n", argv[i]);
+                app_free(&app); return 1;
+            }
+        } else if (strcmp(argv[i], "--shard") == 0 && i+1 < argc) {
+            int ok = shard_serve(&app, argv[++i]);
+            if (!ok) fprintf(stderr, "Cannot serve shard on %s\n", argv[i]);
+            app_free(&app); return ok ? 0 : 1;
+        } else if (strcmp(argv[i], "--router") == 0 && i+1 < argc) {
+            int ok = router_run(argv[++i]);
+            app_free(&app); return ok ? 0 : 1;
+        } else if (strcmp(argv[i], "--delivery-ring") == 0 && i+1 < argc) {
+            app.delivery = (ShmRing*)calloc(1, sizeof(ShmRing));
+            if (!app.delivery || !shmring_attach(app.delivery, argv[++i])) {
+                fprintf(stderr, "No delivery worker ring at %s\n", argv[i]);
+                free(app.delivery); app.delivery = NULL;
+                app_free(&app); return 1;
+            }
+        } else if (strcmp(argv[i], "--delivery-worker") == 0 && i+1 < argc) {
+            int ok = delivery_worker_run(argv[++i]);
+            if (!ok) fprintf(stderr, "Cannot create delivery ring %s\n", argv[i]);
+            app_free(&app); return ok ? 0 : 1;
+        } else if (strcmp(argv[i], "--handoff") == 0 && i+1 < argc) {
+            handoff = argv[++i];            /* attached once the sockets are open */
+        } else if (strcmp(argv[i], "--user-store") == 0 && i+1 < argc) {
+            if (!(app.ustore = ustore_open(argv[++i], 0))) {
+                fprintf(stderr, "Cannot open user store %s\n", argv[i]);
+                app_free(&app); return 1;
+            }
+        } else if (strcmp(argv[i], "--post-store") == 0 && i+1 < argc) {
+            if (!(app.lsm = lsm_open(argv[++i]))) {
+                fprintf(stderr, "Cannot open post store %s\n", argv[i]);
+                app_free(&app); return 1;
+            }
+            next_post_id_reset(lsm_max_id(app.lsm) + 1);
+        } else if (strcmp(argv[i], "--batch") == 0 && i+1 < argc) {
+            if (!input_open(argv[++i])) {
+                fprintf(stderr, "Cannot open batch file %s\n", argv[i]);
+                app_free(&app); return 1;
+            }
+        } else if (strcmp(argv[i], "--trace") == 0 && i+1 < argc) {
+            /* before --shard/--router/--bench to trace those too */
+            if (!trace_open(argv[++i])) {
+                fprintf(stderr, "Cannot trace to %s\n", argv[i]);
+                app_free(&app); return 1;
+            }
+        } else if (strcmp(argv[i], "--bench") == 0 && i+1 < argc) {
+            const char *name = argv[++i];
+            long n = i+1 < argc ? strtol(argv[++i], NULL, 10) : 0;
+            int ok = bench_run(name, n);
+            if (!ok) fprintf(stderr, "Unknown benchmark %s\n", name);
+            app_free(&app); return ok ? 0 : 1;
+        } else { usage(argv[0]); app_free(&app); return 1; }
+    }
 
     char buf[32];
     int choice;
 
+    if (handoff) {
+        clock_t t0 = clock();
+        if (app_handoff_attach(&app, handoff))
+            printf("Resumed %d users and %d posts from %s in %.2f ms\n", app.graph.user_count,
+                   app.posts.size, handoff, 1000.0*(double)(clock()-t0)/CLOCKS_PER_SEC);
+    }
+
     puts("Welcome to SMM (MVP) — session-based, in-memory.");
+    app_rank_feeds(&app);
 
     while (1) {
+        cdc_flush(&app.cdc);
+        app_feed_warm(&app, FEED_WARM_PER_TURN);
+        if (app_export_step(&app, EXPORT_PER_TURN))
+            printf("Export to %s finished: %ld users, %ld follows, %ld posts.\n",
+                   app.export->path, app.export->users, app.export->edges, app.export->posts);
         print_menu();
         if (!get_line(buf, sizeof buf)) break;
+        replica_poll(&app);   /* serve reads from the freshest state */
         choice = (int)strtol(buf, NULL, 10);
 
         switch(choice){
@@ -36,7 +128,18 @@ int main(void){
             case 14: ui_admin_login(&app); break;
             case 15: ui_admin_logout(&app); break;
             case 16: ui_admin_change_limits(&app); break;
+            case 17: ui_new_posts(&app); break;
+            case 18: ui_admin_stats(&app); break;
+            case 19: ui_view_feed(&app); break;
+            case 20: ui_show_mutual(&app); break;
+            case 21: ui_admin_analytics(&app); break;
+            case 22: ui_new_followers(&app); break;
+            case 23: ui_follow_many(&app); break;
+            case 24: ui_unfollow_many(&app); break;
+            case 25: ui_admin_export(&app); break;
             case 0: 
+                if (handoff && !app_handoff_save(&app, handoff))
+                    fprintf(stderr, "Could not save state to %s\n", handoff);
                 app_free(&app); 
                 puts("Bye!");
                 return 0;
@@ -44,6 +147,8 @@ int main(void){
         }
     }
 
+    if (handoff && !app_handoff_save(&app, handoff))
+        fprintf(stderr, "Could not save state to %s\n", handoff);
     app_free(&app);
     return 0;
 }
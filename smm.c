@@ -1,75 +1,275 @@
 /* smm.c — Minimal Social Media Manager (MVP) */
+#ifndef _WIN32
+#define _DEFAULT_SOURCE     /* POSIX/BSD calls (syscall, fdopen, ftruncate...) under -std=c11 */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <time.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <sys/stat.h>
 #include "smm.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 #ifdef _WIN32
-#include <conio.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#include <io.h>
+#include <fcntl.h>
+#include <errno.h>
+#define mkdir(path, mode) _mkdir(path)
 #else
 #include <termios.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <signal.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 #endif
 
 /* ====== Small utilities ====== */
+void sb_init(StrBuf *sb){ sb->data=NULL; sb->len=sb->cap=0; }
+static int sb_reserve(StrBuf *sb, size_t extra){
+    if (sb->len + extra < sb->cap) return 1;
+    size_t nc = sb->cap ? sb->cap*2 : 256;
+    while (nc <= sb->len + extra) nc *= 2;
+    char *tmp = (char*)realloc(sb->data, nc);
+    if (!tmp) return 0;
+    sb->data = tmp; sb->cap = nc;
+    return 1;
+}
+int sb_vprintf(StrBuf *sb, const char *fmt, va_list ap){
+    for (;;){
+        size_t room = sb->cap - sb->len;
+        va_list cp; va_copy(cp, ap);
+        int n = vsnprintf(room ? sb->data + sb->len : NULL, room, fmt, cp);
+        va_end(cp);
+        if (n < 0) return 0;
+        if ((size_t)n < room){ sb->len += (size_t)n; return 1; }
+        if (!sb_reserve(sb, (size_t)n)) return 0;
+    }
+}
+/* Append formatted text, growing the buffer as needed. Returns 0 on OOM. */
+int sb_printf(StrBuf *sb, const char *fmt, ...){
+    va_list ap; va_start(ap,fmt);
+    int r = sb_vprintf(sb,fmt,ap);
+    va_end(ap);
+    return r;
+}
+int sb_append(StrBuf *sb, const char *buf, size_t n){
+    if (!sb_reserve(sb, n)) return 0;
+    memcpy(sb->data + sb->len, buf, n); sb->len += n;
+    sb->data[sb->len] = '\0';
+    return 1;
+}
+void sb_free(StrBuf *sb){ free(sb->data); sb_init(sb); }
+
+/* ====== Tracing ====== */
+atomic_int trace_on;
+static _Thread_local TraceRing *trace_ring;
+static TraceRing *trace_rings;             /* every thread's ring, for dumps */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long trace_origin;
+static const char *trace_path;
+
+unsigned long long trace_now(void){
+    struct timespec ts; timespec_get(&ts, TIME_UTC);
+    unsigned long long t = (unsigned long long)ts.tv_sec*1000000000ull + (unsigned long long)ts.tv_nsec;
+    return t ? t : 1;                      /* 0 marks a span begun with tracing off */
+}
+/* A thread's ring is allocated on its first event and lives until exit. */
+void trace_record(const TraceSpan *s){
+    unsigned long long t1 = trace_now();
+    TraceRing *r = trace_ring;
+    if (!r){
+        if (!(r = (TraceRing*)calloc(1, sizeof *r))) return;
+        pthread_mutex_lock(&trace_lock);
+        r->tid = trace_rings ? trace_rings->tid + 1 : 1;
+        r->next = trace_rings; trace_rings = r;
+        pthread_mutex_unlock(&trace_lock);
+        trace_ring = r;
+    }
+    unsigned long h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    TraceEvent *e = &r->ev[h % TRACE_RING_EVENTS];
+    e->name = s->name; e->ts = s->t0; e->dur = t1 > s->t0 ? t1 - s->t0 : 0;
+    atomic_store_explicit(&r->head, h+1, memory_order_release);
+}
+/* Events still being overwritten by a busy thread may come out torn; dump
+ * when the process is quiet (it runs at exit for --trace). */
+int trace_dump(const char *path){
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    fputs("{\"traceEvents\":[", f);
+    int first = 1;
+    pthread_mutex_lock(&trace_lock);
+    for (TraceRing *r=trace_rings; r; r=r->next){
+        unsigned long h = atomic_load_explicit(&r->head, memory_order_acquire);
+        unsigned long i = h > TRACE_RING_EVENTS ? h - TRACE_RING_EVENTS : 0;
+        for (; i<h; i++){
+            const TraceEvent *e = &r->ev[i % TRACE_RING_EVENTS];
+            unsigned long long ts = e->ts > trace_origin ? e->ts - trace_origin : 0;
+            fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"smm\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}",
+                    first ? "" : ",", e->name, r->tid, ts/1000, ts%1000, e->dur/1000, e->dur%1000);
+            first = 0;
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+    fputs("\n],\"displayTimeUnit\":\"ns\"}\n", f);
+    return fclose(f) == 0;
+}
+static void trace_at_exit(void){
+    atomic_store(&trace_on, 0);
+    if (trace_path && !trace_dump(trace_path)) fprintf(stderr, "Could not write trace to %s\n", trace_path);
+}
+/* Turn tracing on for the rest of the process; the trace is written to
+ * path at exit. */
+int trace_open(const char *path){
+    if (trace_path) return 0;
+    trace_path = path;
+    trace_origin = trace_now();
+    if (atexit(trace_at_exit) != 0){ trace_path = NULL; return 0; }
+    atomic_store(&trace_on, 1);
+    return 1;
+}
+
+/* ====== Buffered output ====== */
+/* Listings and menus format into one reusable buffer and reach the stream
+ * in a single write per screen, instead of one stdio call (and, on a
+ * line-buffered terminal, one write syscall) per line. */
+static StrBuf out_buf;
+static FILE *out_target;
+
+void out_set_target(FILE *f){ out_flush(); out_target = f; }
+static void out_maybe_flush(void){ if (out_buf.len >= OUT_FLUSH_AT) out_flush(); }
+void out_printf(const char *fmt, ...){
+    va_list ap; va_start(ap,fmt);
+    sb_vprintf(&out_buf,fmt,ap);
+    va_end(ap);
+    out_maybe_flush();
+}
+void out_write(const char *buf, size_t n){
+    sb_append(&out_buf,buf,n);
+    out_maybe_flush();
+}
+void out_puts(const char *s){ out_write(s, strlen(s)); out_write("\n", 1); }
+/* Anything printed directly with stdio is flushed first to keep ordering. */
+void out_flush(void){
+    FILE *f = out_target ? out_target : stdout;
+    if (out_buf.len){
+        fflush(stdout);
+        fwrite(out_buf.data, 1, out_buf.len, f);
+        out_buf.len = 0;
+    }
+    fflush(f);
+}
+
+/* ====== Buffered input ====== */
+int lr_init(LineReader *r, int fd){
+    r->fd = fd; r->start = r->end = 0; r->eof = 0;
+    r->cap = LR_BUF;
+    r->buf = (char*)malloc(r->cap);
+    return r->buf != NULL;
+}
+/* Next line without its newline (and any '\r'). Returns 0 at end of input. */
+int lr_next(LineReader *r, char **line, size_t *len){
+    for (;;){
+        char *s = r->buf + r->start;
+        char *nl = (char*)memchr(s, '\n', r->end - r->start);   /* vectorised in libc */
+        if (nl || (r->eof && r->start < r->end)){
+            char *e = nl ? nl : r->buf + r->end;
+            r->start = (size_t)(e - r->buf) + (nl ? 1 : 0);
+            if (e > s && e[-1] == '\r') e--;
+            *e = '\0';
+            *line = s; *len = (size_t)(e - s);
+            return 1;
+        }
+        if (r->eof) return 0;
+        if (r->start){
+            memmove(r->buf, s, r->end - r->start);
+            r->end -= r->start; r->start = 0;
+        }
+        if (r->end + 1 >= r->cap){              /* keep a byte for the terminator */
+            char *tmp = (char*)realloc(r->buf, r->cap*2);
+            if (!tmp){ r->eof = 1; continue; }
+            r->buf = tmp; r->cap *= 2;
+        }
+        long n = (long)read(r->fd, r->buf + r->end, (unsigned)(r->cap - 1 - r->end));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) r->eof = 1; else r->end += (size_t)n;
+    }
+}
+void lr_free(LineReader *r){ free(r->buf); r->buf = NULL; r->start = r->end = r->cap = 0; }
+
+/* The menu loop, prompts and batch/router input all read from here. */
+static LineReader input;
+static int input_ready;
+LineReader* input_reader(void){
+    if (!input_ready) input_ready = lr_init(&input, 0);
+    return &input;
+}
+/* Batch mode: take input from a file instead of the terminal. */
+int input_open(const char *path){
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    if (input_ready) lr_free(&input);
+    input_ready = lr_init(&input, fd);
+    return input_ready;
+}
+static int input_is_tty(void){ return !input_ready || input.fd == 0 ? isatty(0) : 0; }
+
+/* Copies the next input line into buf, truncating overlong lines. */
 int get_line(char *buf, int n) {
-    if (!fgets(buf, n, stdin)) return 0;
-    char *nl = strchr(buf, '\n');
-    if (nl) *nl = '\0';
-    else { int c; while ((c = getchar()) != '\n' && c != EOF); }
+    char *line; size_t len;
+    out_flush();                                 /* show any pending prompt */
+    fflush(stdout);
+    if (!lr_next(input_reader(), &line, &len)) return 0;
+    if (len >= (size_t)n) len = (size_t)n - 1;
+    memcpy(buf, line, len); buf[len] = '\0';
     return 1;
 }
 
-/* Read password with masked asterisks while typing. Cross-platform.
- * Returns 1 on success, 0 on EOF/error.
+/* Read a password through the input reader like any other line, with
+ * terminal echo turned off only for that read. Returns 1 on success,
+ * 0 on EOF/error.
  */
 int get_password(char *buf, int n) {
+    if (!input_is_tty()) return get_line(buf, n);   /* piped / batch input */
 #ifdef _WIN32
-    int idx = 0;
-    int ch;
-    while ((ch = _getch()) != '\r' && ch != '\n' && ch != EOF) {
-        if (ch == 3) return 0; /* Ctrl-C */
-        if (ch == 8 || ch == 127) { /* backspace */
-            if (idx > 0) { idx--; buf[idx] = '\0'; printf("\b \b"); }
-        } else if (idx < n-1) {
-            buf[idx++] = (char)ch;
-            putchar('*');
-        }
-    }
-    buf[idx] = '\0'; putchar('\n'); return 1;
+    HANDLE h = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD mode;
+    if (!GetConsoleMode(h, &mode) || !SetConsoleMode(h, mode & ~(DWORD)ENABLE_ECHO_INPUT)) return 0;
+    int ok = get_line(buf, n);
+    SetConsoleMode(h, mode);
 #else
     struct termios oldt, newt;
     if (tcgetattr(STDIN_FILENO, &oldt) != 0) return 0;
     newt = oldt;
-    newt.c_lflag &= ~(ECHO | ICANON);
+    newt.c_lflag &= ~(tcflag_t)ECHO;                /* keep ICANON: the tty does line editing */
     if (tcsetattr(STDIN_FILENO, TCSANOW, &newt) != 0) return 0;
-    int idx = 0;
-    int ch;
-    while (1) {
-        ch = getchar();
-        if (ch == EOF) { tcsetattr(STDIN_FILENO, TCSANOW, &oldt); return 0; }
-        if (ch == '\n' || ch == '\r') break;
-        if (ch == 3) { tcsetattr(STDIN_FILENO, TCSANOW, &oldt); return 0; } /* Ctrl-C */
-        if (ch == 8 || ch == 127) { /* backspace */
-            if (idx > 0) { idx--; buf[idx] = '\0'; printf("\b \b"); }
-        } else if (idx < n-1) {
-            buf[idx++] = (char)ch;
-            putchar('*');
-            fflush(stdout);
-        }
-    }
-    buf[idx] = '\0';
+    int ok = get_line(buf, n);
     tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-    putchar('\n');
-    return 1;
 #endif
+    putchar('\n');
+    return ok;
 }
 
 /* Format current time as dd/mm/yyyy hh:mm:ss am/pm */
-void format_timestamp(char *buf, int n) {
-    time_t now = time(NULL);
-    struct tm *t = localtime(&now);
+void format_timestamp(char *buf, int n) { format_time(buf, n, time(NULL)); }
+void format_time(char *buf, int n, time_t when) {
+    struct tm *t = localtime(&when);
     int hour = t->tm_hour;
     const char *ampm = (hour >= 12) ? "pm" : "am";
     if (hour == 0) hour = 12;
@@ -79,7 +279,48 @@ void format_timestamp(char *buf, int n) {
              hour, t->tm_min, t->tm_sec, ampm);
 }
 
-int next_post_id(void) { static int id = 1; return id++; }
+/* Fixed-width name compare. Both operands must be padded (stored fields or
+ * a NameKey); ordering matches strcmp because the padding is all zeros. */
+_Static_assert(USERNAME_MAX == 32, "name_eq/name_cmp compare exactly 32 bytes");
+/* Copy at most USERNAME_MAX-1 bytes without reading past the NUL
+ * (strnlen is POSIX, not C11). */
+void name_key(NameKey *k, const char *s){
+    size_t n = 0;
+    while (n < USERNAME_MAX-1 && s[n]) n++;
+    memset(k->s, 0, USERNAME_MAX);
+    memcpy(k->s, s, n);
+}
+static unsigned name_diff_mask(const char *a, const char *b){
+#if defined(__AVX2__)
+    __m256i x = _mm256_loadu_si256((const __m256i*)a), y = _mm256_loadu_si256((const __m256i*)b);
+    return ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x,y));
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128i x0 = _mm_loadu_si128((const __m128i*)a), y0 = _mm_loadu_si128((const __m128i*)b);
+    __m128i x1 = _mm_loadu_si128((const __m128i*)(a+16)), y1 = _mm_loadu_si128((const __m128i*)(b+16));
+    unsigned lo = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x0,y0));
+    unsigned hi = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x1,y1));
+    return ~(lo | hi<<16);
+#else
+    unsigned m = 0;
+    for (int i=0;i<USERNAME_MAX;i++) if (a[i]!=b[i]) m |= 1u<<i;
+    return m;
+#endif
+}
+int name_eq(const char *a, const char *b){ return name_diff_mask(a,b) == 0; }
+int name_cmp(const char *a, const char *b){
+    unsigned m = name_diff_mask(a,b);
+    if (!m) return 0;
+#if defined(__GNUC__)
+    int i = __builtin_ctz(m);
+#else
+    int i = 0; while (!(m & 1u)){ m >>= 1; i++; }
+#endif
+    return (unsigned char)a[i] - (unsigned char)b[i];
+}
+
+static int post_id_counter = 1;
+int next_post_id(void) { return post_id_counter++; }
+void next_post_id_reset(int next) { if (next > post_id_counter) post_id_counter = next; }
 
 static int valid_name(const char *s) {
     if (!s || !*s || strlen(s) >= USERNAME_MAX) return 0;
@@ -92,195 +333,3493 @@ static int valid_name(const char *s) {
 void posts_init(PostArray *pa, int initial_cap) {
     pa->size = 0; pa->cap = initial_cap;
     pa->data = (Post*)malloc(sizeof(Post)*pa->cap);
+    pa->on_add = NULL; pa->on_add_ctx = NULL;
+}
+void posts_free(PostArray *pa) {
+    free(pa->data); pa->data = NULL; pa->size = pa->cap = 0;
+}
+int posts_add(PostArray *pa, const Post *p) {
+    TRACE_SPAN("posts_add");
+    if (pa->size >= MAX_POSTS) return 0; /* hard stop for demo */
+    if (pa->size == pa->cap) {
+        int nc = pa->cap*2; if (nc > MAX_POSTS) nc = MAX_POSTS;
+        Post *tmp = (Post*)realloc(pa->data, sizeof(Post)*nc);
+        if (!tmp) return 0;
+        pa->data = tmp; pa->cap = nc;
+    }
+    pa->data[pa->size++] = *p;
+    if (pa->on_add) pa->on_add(pa->on_add_ctx, &pa->data[pa->size-1]);
+    return 1;
+}
+/* Ids come from next_post_id() and are appended in order, so binary search. */
+const Post* posts_find(const PostArray *pa, int id) {
+    TRACE_SPAN("posts_find");
+    int lo = 0, hi = pa->size-1;
+    while (lo <= hi) {
+        int mid = lo + (hi-lo)/2, v = pa->data[mid].id;
+        if (v == id) return &pa->data[mid];
+        if (v < id) lo = mid+1; else hi = mid-1;
+    }
+    return NULL;
+}
+void posts_list_desc(const PostArray *pa) {
+    if (pa->size == 0) { puts("No posts yet."); return; }
+    out_puts("Posts (newest first):");
+    for (int i = pa->size-1; i >= 0; --i) {
+        const Post *p = &pa->data[i];
+        out_printf(" #%d by %s at %s: %s\n", p->id, p->author, p->timestamp, p->content);
+    }
+    out_flush();
+}
+
+/* ====== LSM (Posts on disk) ====== */
+#define LSM_MAGIC 0x4e55524cu   /* "LRUN" */
+
+static void lsm_run_path(const LsmStore *s, unsigned long long no, char *out, size_t n){
+    snprintf(out, n, "%s/posts-%06llu.run", s->dir, no);
+}
+static unsigned lsm_hash(int id, unsigned seed){
+    unsigned h = (unsigned)id * 2654435761u ^ seed;
+    h ^= h >> 16; h *= 0x7feb352du; h ^= h >> 15; h *= 0x846ca68bu; h ^= h >> 16;
+    return h;
+}
+static void bloom_add(LsmRun *r, int id){
+    unsigned h1 = lsm_hash(id,0), h2 = lsm_hash(id,0x9e3779b9u) | 1;
+    for (int k=0;k<LSM_BLOOM_K;k++){ unsigned b = (h1 + (unsigned)k*h2) % r->bloom_bits; r->bloom[b>>3] |= (unsigned char)(1u << (b&7)); }
+}
+static int bloom_maybe(const LsmRun *r, int id){
+    unsigned h1 = lsm_hash(id,0), h2 = lsm_hash(id,0x9e3779b9u) | 1;
+    for (int k=0;k<LSM_BLOOM_K;k++){ unsigned b = (h1 + (unsigned)k*h2) % r->bloom_bits; if (!(r->bloom[b>>3] & (1u << (b&7)))) return 0; }
+    return 1;
+}
+static void lsm_run_free(LsmRun *r){
+    if (!r) return;
+    free(r->bloom); free(r->fences); free(r);
+}
+static LsmRun* lsm_run_new(unsigned long long no, int count){
+    LsmRun *r = (LsmRun*)calloc(1,sizeof(LsmRun));
+    if (!r) return NULL;
+    r->file_no = no; r->count = count;
+    r->bloom_bits = (unsigned)(count > 0 ? count : 1) * LSM_BLOOM_BITS;
+    r->bloom = (unsigned char*)calloc((r->bloom_bits+7)/8, 1);
+    r->fences = (int*)malloc(sizeof(int)*(size_t)(count/LSM_FENCE_STRIDE + 1));
+    if (!r->bloom || !r->fences){ lsm_run_free(r); return NULL; }
+    return r;
+}
+static void lsm_run_index(LsmRun *r, int i, int id){
+    if (i % LSM_FENCE_STRIDE == 0) r->fences[i / LSM_FENCE_STRIDE] = id;
+    bloom_add(r, id);
+}
+/* Rebuild the in-memory filter and fences of an existing run file. */
+static LsmRun* lsm_run_load(const LsmStore *s, unsigned long long no){
+    char path[LSM_PATH_MAX+32]; lsm_run_path(s,no,path,sizeof path);
+    FILE *f = fopen(path,"rb");
+    if (!f) return NULL;
+    LsmRunHdr h; LsmRun *r = NULL;
+    if (fread(&h,sizeof h,1,f)==1 && h.magic==LSM_MAGIC && (r = lsm_run_new(no,(int)h.count))){
+        r->min_id = h.min_id; r->max_id = h.max_id;
+        Post p;
+        for (int i=0;i<r->count;i++){
+            if (fread(&p,sizeof p,1,f)!=1){ lsm_run_free(r); r = NULL; break; }
+            lsm_run_index(r,i,p.id);
+        }
+    }
+    fclose(f);
+    return r;
+}
+/* The manifest lists live run numbers, oldest first. It is written to a
+ * temp file, synced and renamed over the old one, so a crash leaves either
+ * the old or the new list (Windows has to remove the old file first). */
+static int lsm_write_manifest(const LsmStore *s){
+    char path[LSM_PATH_MAX+32], tmp[LSM_PATH_MAX+32];
+    snprintf(path,sizeof path,"%s/MANIFEST",s->dir);
+    snprintf(tmp,sizeof tmp,"%s/MANIFEST.tmp",s->dir);
+    FILE *f = fopen(tmp,"w");
+    if (!f) return 0;
+    fprintf(f,"%llu\n", s->next_file);
+    for (int i=0;i<s->nruns;i++) fprintf(f,"%llu\n", s->runs[i]->file_no);
+    int ok = fflush(f)==0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(f))==0;
+#else
+    ok = ok && fsync(fileno(f))==0;           /* contents durable before the rename */
+#endif
+    if (fclose(f)!=0 || !ok){ remove(tmp); return 0; }
+#ifdef _WIN32
+    remove(path);                             /* rename() will not replace there */
+#endif
+    return rename(tmp,path)==0;
+}
+
+/* Writes posts[0..n) (sorted by id) as run number `no`. Caller holds no lock. */
+static LsmRun* lsm_write_run(const LsmStore *s, unsigned long long no, const Post *posts, int n){
+    char path[LSM_PATH_MAX+32]; lsm_run_path(s,no,path,sizeof path);
+    LsmRun *r = lsm_run_new(no,n);
+    FILE *f = r ? fopen(path,"wb") : NULL;
+    if (!f){ lsm_run_free(r); return NULL; }
+    LsmRunHdr h = { LSM_MAGIC, (unsigned)n, n ? posts[0].id : 0, n ? posts[n-1].id : 0 };
+    int ok = fwrite(&h,sizeof h,1,f)==1 && fwrite(posts,sizeof(Post),(size_t)n,f)==(size_t)n;
+    if (fclose(f)!=0) ok = 0;
+    if (!ok){ remove(path); lsm_run_free(r); return NULL; }
+    r->min_id = h.min_id; r->max_id = h.max_id;
+    for (int i=0;i<n;i++) lsm_run_index(r,i,posts[i].id);
+    return r;
+}
+
+/* Size-tiered: a run's tier is log4 of its size in memtables. The oldest
+ * LSM_COMPACT_AT adjacent runs of one tier are merged into a run of the
+ * next tier, so each post is rewritten O(log n) times. */
+static int lsm_tier(const LsmStore *s, const LsmRun *r){
+    int t = 0;
+    for (long sz = r->count / (s->memtable_max > 0 ? s->memtable_max : 1); sz >= 4; sz /= 4) t++;
+    return t;
+}
+static int lsm_pick(const LsmStore *s, int *start){
+    for (int i=0; i+LSM_COMPACT_AT <= s->nruns; i++){
+        int t = lsm_tier(s,s->runs[i]), k = 1;
+        while (k < LSM_COMPACT_AT && lsm_tier(s,s->runs[i+k]) == t) k++;
+        if (k == LSM_COMPACT_AT){ *start = i; return 1; }
+    }
+    return 0;
+}
+
+/* Background compactor. Post ids only grow, so adjacent runs cover
+ * disjoint, ordered id ranges and merging them is a streamed
+ * concatenation. The merge runs without the lock; only the swap holds it
+ * (flushes only append, so the picked window stays where it was). The
+ * inputs are deleted only once the new MANIFEST is in place; after a
+ * failure the compactor waits for the next flush rather than retrying
+ * the same window in a loop. */
+static void* lsm_compactor(void *arg){
+    LsmStore *s = (LsmStore*)arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;){
+        int start = 0;
+        while (!s->stop && (s->stalled || !lsm_pick(s,&start))) pthread_cond_wait(&s->wake,&s->lock);
+        if (s->stop) break;
+        TRACE_SPAN("lsm_compact");
+        int k = LSM_COMPACT_AT, total = 0;
+        LsmRun *in[LSM_COMPACT_AT];
+        for (int i=0;i<k;i++){ in[i] = s->runs[start+i]; total += in[i]->count; }
+        unsigned long long no = s->next_file++;
+        pthread_mutex_unlock(&s->lock);
+
+        char path[LSM_PATH_MAX+32]; lsm_run_path(s,no,path,sizeof path);
+        LsmRun *out = lsm_run_new(no,total);
+        FILE *f = out ? fopen(path,"wb") : NULL;
+        int ok = f != NULL, idx = 0;
+        LsmRunHdr h = { LSM_MAGIC, (unsigned)total, in[0]->min_id, in[k-1]->max_id };
+        if (ok) ok = fwrite(&h,sizeof h,1,f)==1;
+        Post buf[LSM_FENCE_STRIDE];
+        for (int i=0;i<k && ok;i++){
+            char ip[LSM_PATH_MAX+32]; lsm_run_path(s,in[i]->file_no,ip,sizeof ip);
+            FILE *g = fopen(ip,"rb");
+            ok = g && fseek(g,(long)sizeof(LsmRunHdr),SEEK_SET)==0;
+            size_t got;
+            while (ok && (got = fread(buf,sizeof(Post),LSM_FENCE_STRIDE,g)) > 0){
+                for (size_t j=0;j<got;j++) lsm_run_index(out,idx++,buf[j].id);
+                ok = fwrite(buf,sizeof(Post),got,f)==got;
+            }
+            if (g) fclose(g);
+        }
+        if (f && fclose(f)!=0) ok = 0;
+        if (ok){ out->min_id = h.min_id; out->max_id = h.max_id; }
+
+        pthread_mutex_lock(&s->lock);
+        if (ok){
+            s->runs[start] = out;
+            memmove(&s->runs[start+1],&s->runs[start+k],sizeof(LsmRun*)*(size_t)(s->nruns-start-k));
+            s->nruns -= k-1;
+            if (!(ok = lsm_write_manifest(s))){     /* put the inputs back */
+                memmove(&s->runs[start+k],&s->runs[start+1],sizeof(LsmRun*)*(size_t)(s->nruns-start-1));
+                memcpy(&s->runs[start],in,sizeof in);
+                s->nruns += k-1;
+            }
+        }
+        if (!ok){ remove(path); lsm_run_free(out); s->stalled = 1; continue; }
+        for (int i=0;i<k;i++){
+            char ip[LSM_PATH_MAX+32]; lsm_run_path(s,in[i]->file_no,ip,sizeof ip);
+            remove(ip); lsm_run_free(in[i]);
+        }
+        s->compactions++;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+LsmStore* lsm_open(const char *dir){
+    LsmStore *s = (LsmStore*)calloc(1,sizeof(LsmStore));
+    if (!s || strlen(dir) >= LSM_PATH_MAX){ free(s); return NULL; }
+    strcpy(s->dir,dir);
+    mkdir(dir, 0755);
+    s->memtable_max = MAX_POSTS;
+    s->next_file = 1;
+    char path[LSM_PATH_MAX+32]; snprintf(path,sizeof path,"%s/MANIFEST",dir);
+    FILE *f = fopen(path,"r");
+    if (f){
+        unsigned long long no;
+        if (fscanf(f,"%llu",&s->next_file)!=1) s->next_file = 1;
+        while (s->nruns < LSM_MAX_RUNS && fscanf(f,"%llu",&no)==1){
+            LsmRun *r = lsm_run_load(s,no);
+            if (r) s->runs[s->nruns++] = r;
+        }
+        fclose(f);
+    }
+    s->cache = rcache_new(RC_POST_CAP, sizeof(Post));
+    pthread_mutex_init(&s->lock,NULL);
+    pthread_cond_init(&s->wake,NULL);
+    if (pthread_create(&s->compactor,NULL,lsm_compactor,s)!=0){
+        rcache_free(s->cache);
+        for (int i=0;i<s->nruns;i++) lsm_run_free(s->runs[i]);
+        pthread_mutex_destroy(&s->lock); pthread_cond_destroy(&s->wake);
+        free(s); return NULL;
+    }
+    return s;
+}
+
+/* Turn the memtable into a new run and empty it. */
+int lsm_flush(LsmStore *s, PostArray *mem){
+    TRACE_SPAN("lsm_flush");
+    if (mem->size == 0) return 1;
+    pthread_mutex_lock(&s->lock);
+    while (s->nruns >= LSM_MAX_RUNS){       /* compactor is behind: wait for it */
+        s->stalled = 0;
+        pthread_cond_signal(&s->wake);
+        pthread_mutex_unlock(&s->lock);
+        struct timespec ts = { 0, 1000000L }; nanosleep(&ts,NULL);
+        pthread_mutex_lock(&s->lock);
+    }
+    unsigned long long no = s->next_file++;
+    pthread_mutex_unlock(&s->lock);
+    LsmRun *r = lsm_write_run(s,no,mem->data,mem->size);
+    if (!r) return 0;
+    pthread_mutex_lock(&s->lock);
+    s->runs[s->nruns++] = r;
+    if (!lsm_write_manifest(s)){            /* unlisted run: drop it, keep the memtable */
+        char path[LSM_PATH_MAX+32]; lsm_run_path(s,no,path,sizeof path);
+        s->nruns--;
+        pthread_mutex_unlock(&s->lock);
+        remove(path); lsm_run_free(r);
+        return 0;
+    }
+    s->flushes++;
+    s->stalled = 0;
+    pthread_cond_signal(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+    mem->size = 0;
+    return 1;
+}
+
+static int lsm_read_block(const LsmStore *s, const LsmRun *r, int block, Post *buf){
+    char path[LSM_PATH_MAX+32]; lsm_run_path(s,r->file_no,path,sizeof path);
+    FILE *f = fopen(path,"rb");
+    if (!f) return 0;
+    int first = block*LSM_FENCE_STRIDE, n = r->count - first;
+    if (n > LSM_FENCE_STRIDE) n = LSM_FENCE_STRIDE;
+    int ok = fseek(f,(long)(sizeof(LsmRunHdr) + sizeof(Post)*(size_t)first),SEEK_SET)==0
+          && fread(buf,sizeof(Post),(size_t)n,f)==(size_t)n;
+    fclose(f);
+    return ok ? n : 0;
+}
+/* Point lookup in the runs (the caller checks the memtable first). Posts
+ * are immutable once flushed, so cached copies never go stale. */
+int lsm_get(LsmStore *s, int id, Post *out){
+    TRACE_SPAN("lsm_get");
+    if (s->cache && rcache_get(s->cache,(unsigned long long)id,out)) return 1;
+    int found = 0;
+    pthread_mutex_lock(&s->lock);
+    for (int i=s->nruns-1; i>=0 && !found; i--){
+        const LsmRun *r = s->runs[i];
+        if (id < r->min_id || id > r->max_id) continue;
+        if (!bloom_maybe(r,id)){ s->bloom_skips++; continue; }
+        int lo=0, hi=(r->count-1)/LSM_FENCE_STRIDE;   /* last fence <= id */
+        while (lo < hi){ int mid=(lo+hi+1)/2; if (r->fences[mid] <= id) lo=mid; else hi=mid-1; }
+        Post buf[LSM_FENCE_STRIDE];
+        int n = lsm_read_block(s,r,lo,buf);
+        s->run_reads++;
+        for (int k=0;k<n;k++) if (buf[k].id == id){ *out = buf[k]; found = 1; break; }
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (found && s->cache) rcache_put(s->cache,(unsigned long long)id,out);
+    return found;
+}
+int lsm_max_id(LsmStore *s){
+    pthread_mutex_lock(&s->lock);
+    int m = s->nruns ? s->runs[s->nruns-1]->max_id : 0;
+    pthread_mutex_unlock(&s->lock);
+    return m;
+}
+/* Visit posts newest first: memtable, then runs from newest to oldest,
+ * each read backwards one block at a time. fn returns 0 to stop. */
+void lsm_foreach_desc(LsmStore *s, const PostArray *mem, int (*fn)(void *ctx, const Post *p), void *ctx){
+    for (int i=mem->size-1;i>=0;--i)
+        if (!fn(ctx,&mem->data[i])) return;
+    pthread_mutex_lock(&s->lock);
+    Post buf[LSM_FENCE_STRIDE];
+    for (int i=s->nruns-1;i>=0;i--){
+        const LsmRun *r = s->runs[i];
+        for (int b=(r->count-1)/LSM_FENCE_STRIDE; b>=0; b--){
+            int n = lsm_read_block(s,r,b,buf);
+            for (int k=n-1;k>=0;k--)
+                if (!fn(ctx,&buf[k])){ pthread_mutex_unlock(&s->lock); return; }
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+/* Up to max posts with id < below_id, newest first, straight from the
+ * runs. Keyed by id rather than run position, so a cursor built on it
+ * survives compactions between calls. */
+int lsm_before(LsmStore *s, int below_id, Post *out, int max){
+    TRACE_SPAN("lsm_before");
+    int n = 0;
+    Post buf[LSM_FENCE_STRIDE];
+    pthread_mutex_lock(&s->lock);
+    for (int i=s->nruns-1; i>=0 && n<max; i--){
+        const LsmRun *r = s->runs[i];
+        if (r->min_id >= below_id) continue;
+        int lo=0, hi=(r->count-1)/LSM_FENCE_STRIDE;   /* last block starting below */
+        while (lo < hi){ int mid=(lo+hi+1)/2; if (r->fences[mid] < below_id) lo=mid; else hi=mid-1; }
+        for (int b=lo; b>=0 && n<max; b--){
+            int got = lsm_read_block(s,r,b,buf);
+            for (int k=got-1; k>=0 && n<max; k--)
+                if (buf[k].id < below_id) out[n++] = buf[k];
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return n;
+}
+/* Flushes the memtable so nothing is lost, then stops the compactor. */
+void lsm_close(LsmStore *s, PostArray *mem){
+    if (!s) return;
+    if (mem) lsm_flush(s,mem);
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_signal(&s->wake);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->compactor,NULL);
+    for (int i=0;i<s->nruns;i++) lsm_run_free(s->runs[i]);
+    pthread_mutex_destroy(&s->lock); pthread_cond_destroy(&s->wake);
+    rcache_free(s->cache);
+    free(s);
+}
+
+/* ====== Queue (Circular, fixed-cap) ====== */
+void mq_init(MessageQueue *q){ q->head=q->tail=q->count=0; }
+int mq_enqueue(MessageQueue *q, const Message *m){
+    TRACE_SPAN("mq_enqueue");
+    if (q->count == MAX_MESSAGES) return 0;
+    q->buf[q->tail] = *m;
+    q->tail = (q->tail + 1) % MAX_MESSAGES;
+    q->count++;
+    return 1;
+}
+int mq_dequeue(MessageQueue *q, Message *out){
+    TRACE_SPAN("mq_dequeue");
+    if (q->count == 0) return 0;
+    if (out) *out = q->buf[q->head];
+    q->head = (q->head + 1) % MAX_MESSAGES;
+    q->count--;
+    return 1;
+}
+void mq_print(const MessageQueue *q){
+    if (q->count == 0) { puts("Message queue is empty."); return; }
+    out_puts("Messages in queue (front..back):");
+    for (int i=0, idx=q->head; i<q->count; ++i, idx=(idx+1)%MAX_MESSAGES){
+        const Message *m = &q->buf[idx];
+        out_printf(" from:%s -> to:%s at %s | %.80s\n", m->from, m->to, m->timestamp, m->content);
+    }
+    out_flush();
+}
+
+/* ====== BST (Users) ====== */
+/* The tree orders users by (name hash, name): a lookup compares the hash
+ * held in each node and reads the cold name only when the hashes tie. */
+static unsigned user_hash(const char *s){
+    unsigned h = 2166136261u;
+    for (; *s; s++){ h ^= (unsigned char)*s; h *= 16777619u; }
+    return h;
+}
+void users_init(UserTable *t){ memset(t, 0, sizeof *t); }
+void users_free(UserTable *t){ free(t->hot); free(t->cold); users_init(t); }
+UserHot*  user_hot(const UserTable *t, const UserNode *n){ return &t->hot[n->id]; }
+UserCold* user_cold(const UserTable *t, const UserNode *n){ return &t->cold[n->id]; }
+void users_get(const UserTable *t, int id, User *out){
+    memcpy(out->username, t->cold[id].username, USERNAME_MAX);
+    memcpy(out->password, t->cold[id].password, PASSWORD_MAX);
+    out->followers = t->hot[id].followers;
+    out->following = t->hot[id].following;
+}
+static int users_add(UserTable *t, unsigned h, const NameKey *k, const char *p){
+    if (t->count == t->cap){
+        int nc = t->cap ? t->cap*2 : 64;
+        UserHot *nh = (UserHot*)realloc(t->hot, sizeof(UserHot)*(size_t)nc);
+        if (!nh) return -1;
+        t->hot = nh;
+        UserCold *ncold = (UserCold*)realloc(t->cold, sizeof(UserCold)*(size_t)nc);
+        if (!ncold) return -1;
+        t->cold = ncold; t->cap = nc;
+    }
+    int id = t->count++;
+    t->hot[id].hash = h; t->hot[id].followers = t->hot[id].following = 0;
+    t->hot[id].mv_epoch = 0;
+    memset(&t->cold[id], 0, sizeof(UserCold));
+    memcpy(t->cold[id].username, k->s, USERNAME_MAX);
+    strncpy(t->cold[id].password,p,PASSWORD_MAX-1);
+    return id;
+}
+static UserNode* make_user(UserTable *t, unsigned h, const NameKey *k, const char *p){
+    UserNode *n=(UserNode*)calloc(1,sizeof(UserNode));
+    if (!n) return NULL;
+    if ((n->id = users_add(t,h,k,p)) < 0){ free(n); return NULL; }
+    n->hash = h;
+    return n;
+}
+static int user_cmp(const UserTable *t, unsigned h, const NameKey *k, const UserNode *n){
+    if (h != n->hash) return h < n->hash ? -1 : 1;
+    return name_cmp(k->s, t->cold[n->id].username);
+}
+static UserNode* bst_insert_h(UserTable *t, UserNode *root, unsigned h, const NameKey *k, const char *password, int *ok){
+    if (!root){ UserNode *n = make_user(t,h,k,password); *ok = n!=NULL; return n; }
+    int c = user_cmp(t, h, k, root);
+    if (c==0){ *ok=0; return root; }
+    if (c<0) root->left = bst_insert_h(t, root->left, h, k, password, ok);
+    else     root->right= bst_insert_h(t, root->right,h, k, password, ok);
+    return root;
+}
+UserNode* bst_insert(UserTable *t, UserNode *root, const char *username, const char *password, int *ok){
+    TRACE_SPAN("bst_insert");
+    NameKey k; name_key(&k, username);
+    return bst_insert_h(t, root, user_hash(k.s), &k, password, ok);
+}
+UserNode* bst_find(const UserTable *t, const UserNode *root, const char *username){
+    TRACE_SPAN("bst_find");
+    NameKey k; name_key(&k, username);
+    unsigned h = user_hash(k.s);
+    while (root){
+        int c = user_cmp(t, h, &k, root);
+        if (c==0) return (UserNode*)root;
+        root = c<0 ? root->left : root->right;
+    }
+    return NULL;
+}
+void bst_free(UserNode *root){
+    if (!root) return;
+    bst_free(root->left); bst_free(root->right); free(root);
+}
+
+/* ====== Record cache (sharded LRU) ====== */
+typedef struct RcEntry {
+    unsigned long long key;
+    int prev, next, hnext;      /* LRU neighbours, hash chain; -1 = none */
+} RcEntry;
+
+#define RC_ENTRY(sh,c,i) ((RcEntry*)((sh)->slab + (size_t)(i)*(c)->entry_size))
+#define RC_REC(e)        ((unsigned char*)(e) + sizeof(RcEntry))
+
+static unsigned long long rc_mix(unsigned long long k){
+    k ^= k >> 33; k *= 0xff51afd7ed558ccdULL; k ^= k >> 33; k *= 0xc4ceb9fe1a85ec53ULL; k ^= k >> 33;
+    return k;
+}
+RecCache* rcache_new(int capacity, size_t rec_size){
+    RecCache *c = (RecCache*)calloc(1,sizeof(RecCache));
+    if (!c) return NULL;
+    c->rec_size = rec_size;
+    c->entry_size = (sizeof(RcEntry) + rec_size + 7) & ~(size_t)7;
+    int per = capacity / RC_SHARDS; if (per < 1) per = 1;
+    int nb = 1; while (nb < per*2) nb <<= 1;
+    for (int s=0;s<RC_SHARDS;s++) pthread_mutex_init(&c->shards[s].lock,NULL);
+    for (int s=0;s<RC_SHARDS;s++){
+        RcShard *sh = &c->shards[s];
+        sh->cap = per; sh->nbuckets = nb;
+        sh->slab = (unsigned char*)malloc(c->entry_size*(size_t)per);
+        sh->buckets = (int*)malloc(sizeof(int)*(size_t)nb);
+        if (!sh->slab || !sh->buckets){ rcache_free(c); return NULL; }
+        for (int i=0;i<nb;i++) sh->buckets[i] = -1;
+        sh->head = sh->tail = -1;
+        for (int i=0;i<per;i++) RC_ENTRY(sh,c,i)->next = i+1 < per ? i+1 : -1;
+        sh->free_list = 0;
+    }
+    return c;
+}
+static RcShard* rc_shard(RecCache *c, unsigned long long h){ return &c->shards[h >> 61 & (RC_SHARDS-1)]; }
+
+static void rc_unlink(RecCache *c, RcShard *sh, int i){
+    RcEntry *e = RC_ENTRY(sh,c,i);
+    if (e->prev >= 0) RC_ENTRY(sh,c,e->prev)->next = e->next; else sh->head = e->next;
+    if (e->next >= 0) RC_ENTRY(sh,c,e->next)->prev = e->prev; else sh->tail = e->prev;
+}
+static void rc_push_front(RecCache *c, RcShard *sh, int i){
+    RcEntry *e = RC_ENTRY(sh,c,i);
+    e->prev = -1; e->next = sh->head;
+    if (sh->head >= 0) RC_ENTRY(sh,c,sh->head)->prev = i; else sh->tail = i;
+    sh->head = i;
+}
+static int* rc_chain(RecCache *c, RcShard *sh, unsigned long long key, unsigned long long h){
+    int *pp = &sh->buckets[h & (unsigned long long)(sh->nbuckets-1)];
+    while (*pp >= 0 && RC_ENTRY(sh,c,*pp)->key != key) pp = &RC_ENTRY(sh,c,*pp)->hnext;
+    return pp;
+}
+int rcache_get(RecCache *c, unsigned long long key, void *out){
+    unsigned long long h = rc_mix(key);
+    RcShard *sh = rc_shard(c,h);
+    pthread_mutex_lock(&sh->lock);
+    int i = *rc_chain(c,sh,key,h);
+    if (i >= 0){
+        if (sh->head != i){ rc_unlink(c,sh,i); rc_push_front(c,sh,i); }
+        memcpy(out, RC_REC(RC_ENTRY(sh,c,i)), c->rec_size);
+        sh->hits++;
+    } else sh->misses++;
+    pthread_mutex_unlock(&sh->lock);
+    return i >= 0;
+}
+void rcache_put(RecCache *c, unsigned long long key, const void *rec){
+    unsigned long long h = rc_mix(key);
+    RcShard *sh = rc_shard(c,h);
+    pthread_mutex_lock(&sh->lock);
+    int *pp = rc_chain(c,sh,key,h), i = *pp;
+    if (i >= 0) rc_unlink(c,sh,i);
+    else {
+        if (sh->free_list >= 0){ i = sh->free_list; sh->free_list = RC_ENTRY(sh,c,i)->next; sh->used++; }
+        else {                                       /* evict the least recently used */
+            i = sh->tail;
+            RcEntry *v = RC_ENTRY(sh,c,i);
+            rc_unlink(c,sh,i);
+            int *vp = rc_chain(c,sh,v->key,rc_mix(v->key)); *vp = v->hnext;
+            pp = rc_chain(c,sh,key,h);
+        }
+        RcEntry *e = RC_ENTRY(sh,c,i);
+        e->key = key; e->hnext = -1; *pp = i;
+    }
+    memcpy(RC_REC(RC_ENTRY(sh,c,i)), rec, c->rec_size);
+    rc_push_front(c,sh,i);
+    pthread_mutex_unlock(&sh->lock);
+}
+void rcache_stats(RecCache *c, unsigned long *hits, unsigned long *misses){
+    *hits = *misses = 0;
+    if (!c) return;
+    for (int s=0;s<RC_SHARDS;s++){
+        pthread_mutex_lock(&c->shards[s].lock);
+        *hits += c->shards[s].hits; *misses += c->shards[s].misses;
+        pthread_mutex_unlock(&c->shards[s].lock);
+    }
+}
+void rcache_free(RecCache *c){
+    if (!c) return;
+    for (int s=0;s<RC_SHARDS;s++){
+        free(c->shards[s].slab); free(c->shards[s].buckets);
+        pthread_mutex_destroy(&c->shards[s].lock);
+    }
+    free(c);
+}
+
+/* ====== B+tree (Users on disk) ====== */
+/* Page 0 holds the meta record; every other page is a node:
+ *   leaf:  u8 leaf=1, u16 n, u32 next | User[n] sorted by username
+ *   inner: u8 leaf=0, u16 n, u32 -    | u32 child[n+1] | char key[n][USERNAME_MAX]
+ * child[i] holds keys < key[i]; child[n] holds the rest. */
+#define BT_MAGIC 0x45525442u   /* "BTRE" */
+typedef struct BtHdr { unsigned char leaf, pad; unsigned short n; unsigned next; } BtHdr;
+typedef struct BtMeta { unsigned magic, root, npages; } BtMeta;
+
+#define BT_HDR(pg)    ((BtHdr*)(pg))
+#define BT_USERS(pg)  ((User*)((pg) + 16))
+#define BT_CHILD(pg)  ((unsigned*)((pg) + 16))
+#define BT_KEY(pg,i)  ((char*)((pg) + 16 + 4*(BT_INNER_MAX+1)) + (size_t)(i)*USERNAME_MAX)
+
+static int bp_io(UserStore *s, unsigned page, unsigned char *buf, int write){
+    FILE *f = (FILE*)s->file;
+    if (fseek(f, (long)page*BT_PAGE, SEEK_SET) != 0) return 0;
+    if (write){ s->writes++; return fwrite(buf,BT_PAGE,1,f) == 1; }
+    s->reads++;
+    return fread(buf,BT_PAGE,1,f) == 1;
+}
+static int bp_map(UserStore *s, unsigned page){
+    if (page >= s->where_cap){
+        unsigned nc = s->where_cap ? s->where_cap : 64;
+        while (nc <= page) nc *= 2;
+        int *tmp = (int*)realloc(s->where, sizeof(int)*nc);
+        if (!tmp) return 0;
+        for (unsigned i=s->where_cap;i<nc;i++) tmp[i] = -1;
+        s->where = tmp; s->where_cap = nc;
+    }
+    return 1;
+}
+/* Clock sweep for a victim frame; writes it back if dirty. */
+static int bp_victim(UserStore *s){
+    for (int spins=0; spins < 2*s->nframes+1; spins++){
+        BpFrame *f = &s->frames[s->hand];
+        int idx = s->hand;
+        s->hand = (s->hand + 1) % s->nframes;
+        if (f->pin) continue;
+        if (f->ref){ f->ref = 0; continue; }
+        if (f->page){
+            if (f->dirty && !bp_io(s, f->page, f->data, 1)) return -1;
+            s->where[f->page] = -1;
+        }
+        f->page = 0; f->dirty = 0;
+        return idx;
+    }
+    return -1;    /* every frame pinned */
+}
+/* Pin page and return its bytes; fresh pages are zero-filled, not read. */
+static unsigned char* bp_pin(UserStore *s, unsigned page, int fresh){
+    if (!bp_map(s,page)) return NULL;
+    int i = s->where[page];
+    if (i >= 0){ s->hits++; }
+    else {
+        s->misses++;
+        if ((i = bp_victim(s)) < 0) return NULL;
+        if (fresh) memset(s->frames[i].data, 0, BT_PAGE);
+        else if (!bp_io(s, page, s->frames[i].data, 0)) return NULL;
+        s->frames[i].page = page; s->where[page] = i;
+    }
+    s->frames[i].pin++; s->frames[i].ref = 1;
+    return s->frames[i].data;
+}
+static void bp_unpin(UserStore *s, unsigned page, int dirty){
+    BpFrame *f = &s->frames[s->where[page]];
+    f->pin--; f->dirty |= dirty;
+}
+static unsigned char* bt_alloc(UserStore *s, unsigned *page){
+    *page = s->npages++;
+    return bp_pin(s, *page, 1);
+}
+static void bt_write_meta(UserStore *s){
+    unsigned char buf[BT_PAGE] = {0};
+    BtMeta m = { BT_MAGIC, s->root, s->npages };
+    memcpy(buf,&m,sizeof m);
+    bp_io(s, 0, buf, 1);
+}
+
+/* frames: buffer pool size in pages (0 = BP_DEFAULT_FRAMES). */
+UserStore* ustore_open(const char *path, int frames){
+    if (frames < 8) frames = frames ? 8 : BP_DEFAULT_FRAMES;
+    FILE *f = fopen(path, "r+b");
+    int fresh = 0;
+    if (!f){ f = fopen(path, "w+b"); fresh = 1; }
+    if (!f) return NULL;
+    UserStore *s = (UserStore*)calloc(1,sizeof(UserStore));
+    if (!s){ fclose(f); return NULL; }
+    s->file = f; s->nframes = frames;
+    s->frames = (BpFrame*)calloc((size_t)frames, sizeof(BpFrame));
+    unsigned char *pool = (unsigned char*)malloc((size_t)frames*BT_PAGE);
+    if (!s->frames || !pool){ free(pool); free(s->frames); free(s); fclose(f); return NULL; }
+    for (int i=0;i<frames;i++) s->frames[i].data = pool + (size_t)i*BT_PAGE;
+    unsigned char buf[BT_PAGE];
+    BtMeta m;
+    if (!fresh && bp_io(s,0,buf,0) && (memcpy(&m,buf,sizeof m), m.magic == BT_MAGIC)){
+        s->root = m.root; s->npages = m.npages;
+    } else {
+        s->npages = 1;
+        unsigned char *root = bt_alloc(s, &s->root);
+        if (!root){ ustore_close(s); return NULL; }
+        BT_HDR(root)->leaf = 1;
+        bp_unpin(s, s->root, 1);
+        bt_write_meta(s);
+    }
+    s->reads = s->writes = 0;
+    return s;
+}
+
+/* First slot whose key is >= name (leaf) / child to descend into (inner). */
+static int bt_leaf_pos(unsigned char *pg, const char *name, int *found){
+    int lo=0, hi=BT_HDR(pg)->n;
+    User *u = BT_USERS(pg);
+    while (lo < hi){
+        int mid=(lo+hi)/2;
+        if (strcmp(u[mid].username,name) < 0) lo=mid+1; else hi=mid;
+    }
+    *found = lo < BT_HDR(pg)->n && strcmp(u[lo].username,name)==0;
+    return lo;
+}
+static int bt_child_pos(unsigned char *pg, const char *name){
+    int lo=0, hi=BT_HDR(pg)->n;
+    while (lo < hi){
+        int mid=(lo+hi)/2;
+        if (strcmp(BT_KEY(pg,mid),name) <= 0) lo=mid+1; else hi=mid;
+    }
+    return lo;
+}
+/* Descend to the leaf for name; returns it pinned. */
+static unsigned char* bt_leaf(UserStore *s, const char *name, unsigned *page){
+    unsigned p = s->root;
+    unsigned char *pg = bp_pin(s,p,0);
+    while (pg && !BT_HDR(pg)->leaf){
+        unsigned c = BT_CHILD(pg)[bt_child_pos(pg,name)];
+        bp_unpin(s,p,0);
+        p = c; pg = bp_pin(s,p,0);
+    }
+    *page = p;
+    return pg;
+}
+
+int ustore_find(UserStore *s, const char *username, User *out){
+    TRACE_SPAN("ustore_find");
+    unsigned p; int found;
+    unsigned char *pg = bt_leaf(s,username,&p);
+    if (!pg) return 0;
+    int i = bt_leaf_pos(pg,username,&found);
+    if (found && out) *out = BT_USERS(pg)[i];
+    bp_unpin(s,p,0);
+    return found;
+}
+int ustore_update(UserStore *s, const User *u){
+    TRACE_SPAN("ustore_update");
+    unsigned p; int found;
+    unsigned char *pg = bt_leaf(s,u->username,&p);
+    if (!pg) return 0;
+    int i = bt_leaf_pos(pg,u->username,&found);
+    if (found) BT_USERS(pg)[i] = *u;
+    bp_unpin(s,p,found);
+    return found;
+}
+
+/* Returns -1 on duplicate/error, 0 when done, 1 when page split and
+ * (up_key, up_page) must be inserted into the parent. */
+static int bt_insert_rec(UserStore *s, unsigned p, const User *u, char *up_key, unsigned *up_page){
+    unsigned char *pg = bp_pin(s,p,0);
+    if (!pg) return -1;
+    BtHdr *h = BT_HDR(pg);
+    if (h->leaf){
+        int found, i = bt_leaf_pos(pg,u->username,&found);
+        User *e = BT_USERS(pg);
+        if (found){ bp_unpin(s,p,0); return -1; }
+        if (h->n < BT_LEAF_MAX){
+            memmove(&e[i+1],&e[i],sizeof(User)*(size_t)(h->n-i));
+            e[i] = *u; h->n++;
+            bp_unpin(s,p,1); return 0;
+        }
+        unsigned np; unsigned char *npg = bt_alloc(s,&np);
+        if (!npg){ bp_unpin(s,p,0); return -1; }
+        User tmp[BT_LEAF_MAX+1];
+        memcpy(tmp,e,sizeof(User)*(size_t)i); tmp[i] = *u;
+        memcpy(&tmp[i+1],&e[i],sizeof(User)*(size_t)(h->n-i));
+        int total = h->n+1, left = total/2;
+        memcpy(e,tmp,sizeof(User)*(size_t)left); h->n = (unsigned short)left;
+        BtHdr *nh = BT_HDR(npg); nh->leaf = 1; nh->n = (unsigned short)(total-left);
+        memcpy(BT_USERS(npg),&tmp[left],sizeof(User)*(size_t)(total-left));
+        nh->next = h->next; h->next = np;
+        memcpy(up_key, BT_USERS(npg)[0].username, USERNAME_MAX); *up_page = np;
+        bp_unpin(s,np,1); bp_unpin(s,p,1);
+        return 1;
+    }
+    int ci = bt_child_pos(pg,u->username);
+    char key[USERNAME_MAX]; unsigned child;
+    int r = bt_insert_rec(s, BT_CHILD(pg)[ci], u, key, &child);
+    if (r <= 0){ bp_unpin(s,p,0); return r; }
+    unsigned *ch = BT_CHILD(pg);
+    if (h->n < BT_INNER_MAX){
+        memmove(BT_KEY(pg,ci+1),BT_KEY(pg,ci),(size_t)(h->n-ci)*USERNAME_MAX);
+        memmove(&ch[ci+2],&ch[ci+1],sizeof(unsigned)*(size_t)(h->n-ci));
+        memcpy(BT_KEY(pg,ci),key,USERNAME_MAX); ch[ci+1] = child; h->n++;
+        bp_unpin(s,p,1); return 0;
+    }
+    /* split the inner node; the middle key moves up */
+    char keys[BT_INNER_MAX+1][USERNAME_MAX]; unsigned kids[BT_INNER_MAX+2];
+    memcpy(keys,BT_KEY(pg,0),(size_t)ci*USERNAME_MAX);
+    memcpy(keys[ci],key,USERNAME_MAX);
+    memcpy(keys[ci+1],BT_KEY(pg,ci),(size_t)(h->n-ci)*USERNAME_MAX);
+    memcpy(kids,ch,sizeof(unsigned)*(size_t)(ci+1)); kids[ci+1] = child;
+    memcpy(&kids[ci+2],&ch[ci+1],sizeof(unsigned)*(size_t)(h->n-ci));
+    int total = h->n+1, mid = total/2;
+    unsigned np; unsigned char *npg = bt_alloc(s,&np);
+    if (!npg){ bp_unpin(s,p,0); return -1; }
+    h->n = (unsigned short)mid;
+    memcpy(BT_KEY(pg,0),keys,(size_t)mid*USERNAME_MAX);
+    memcpy(ch,kids,sizeof(unsigned)*(size_t)(mid+1));
+    BtHdr *nh = BT_HDR(npg); nh->leaf = 0; nh->n = (unsigned short)(total-mid-1);
+    memcpy(BT_KEY(npg,0),keys[mid+1],(size_t)nh->n*USERNAME_MAX);
+    memcpy(BT_CHILD(npg),&kids[mid+1],sizeof(unsigned)*(size_t)(nh->n+1));
+    memcpy(up_key,keys[mid],USERNAME_MAX); *up_page = np;
+    bp_unpin(s,np,1); bp_unpin(s,p,1);
+    return 1;
+}
+/* Returns 1 if inserted, 0 if the name exists or on I/O failure. */
+int ustore_insert(UserStore *s, const char *username, const char *password){
+    TRACE_SPAN("ustore_insert");
+    User u; memset(&u,0,sizeof u);
+    strncpy(u.username,username,USERNAME_MAX-1);
+    strncpy(u.password,password,PASSWORD_MAX-1);
+    char key[USERNAME_MAX]; unsigned child;
+    int r = bt_insert_rec(s, s->root, &u, key, &child);
+    if (r < 0) return 0;
+    if (r == 1){
+        unsigned np; unsigned char *pg = bt_alloc(s,&np);
+        if (!pg) return 0;
+        BT_HDR(pg)->leaf = 0; BT_HDR(pg)->n = 1;
+        BT_CHILD(pg)[0] = s->root; BT_CHILD(pg)[1] = child;
+        memcpy(BT_KEY(pg,0),key,USERNAME_MAX);
+        bp_unpin(s,np,1);
+        s->root = np;
+    }
+    return 1;
+}
+/* Removes the record from its leaf. Leaves are allowed to underflow (no
+ * merging): users are rarely deleted and lookups stay correct. */
+int ustore_delete(UserStore *s, const char *username){
+    TRACE_SPAN("ustore_delete");
+    unsigned p; int found;
+    unsigned char *pg = bt_leaf(s,username,&p);
+    if (!pg) return 0;
+    int i = bt_leaf_pos(pg,username,&found);
+    if (found){
+        BtHdr *h = BT_HDR(pg); User *e = BT_USERS(pg);
+        memmove(&e[i],&e[i+1],sizeof(User)*(size_t)(h->n-i-1)); h->n--;
+    }
+    bp_unpin(s,p,found);
+    return found;
+}
+void ustore_close(UserStore *s){
+    if (!s) return;
+    for (int i=0;i<s->nframes;i++)
+        if (s->frames[i].page && s->frames[i].dirty) bp_io(s, s->frames[i].page, s->frames[i].data, 1);
+    if (s->npages) bt_write_meta(s);
+    fclose((FILE*)s->file);
+    if (s->frames) free(s->frames[0].data);
+    free(s->frames); free(s->where); free(s);
+}
+
+/* ====== Roaring bitmap (vertex id sets) ====== */
+static int popcount64(unsigned long long x){
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    int c=0; for (; x; x &= x-1) c++; return c;
+#endif
+}
+static int ctz64(unsigned long long x){
+#if defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    int i=0; while (!(x & 1ull)){ x >>= 1; i++; } return i;
+#endif
+}
+void roar_init(Roaring *r){ r->chunks=NULL; r->n=r->cap=0; }
+static void chunk_free(RoarChunk *c){ free(c->array); free(c->bits); c->array=NULL; c->bits=NULL; }
+void roar_free(Roaring *r){
+    for (int i=0;i<r->n;i++) chunk_free(&r->chunks[i]);
+    free(r->chunks); roar_init(r);
+}
+/* Index of the chunk for `key`, or -(insertion point)-1. */
+static int roar_find(const Roaring *r, unsigned key){
+    int lo=0, hi=r->n-1;
+    while (lo<=hi){
+        int mid=(lo+hi)/2; unsigned k=r->chunks[mid].key;
+        if (k==key) return mid;
+        if (k<key) lo=mid+1; else hi=mid-1;
+    }
+    return -(lo+1);
+}
+/* Lower bound of `low` in a chunk's array. */
+static int chunk_lb(const RoarChunk *c, unsigned low){
+    int lo=0, hi=c->card;
+    while (lo<hi){ int mid=(lo+hi)/2; if (c->array[mid] < low) lo=mid+1; else hi=mid; }
+    return lo;
+}
+static int chunk_to_bits(RoarChunk *c){
+    unsigned long long *b = (unsigned long long*)calloc(ROAR_WORDS, sizeof *b);
+    if (!b) return 0;
+    for (int i=0;i<c->card;i++) b[c->array[i]>>6] |= 1ull << (c->array[i]&63);
+    free(c->array); c->array=NULL; c->cap=0; c->bits=b;
+    return 1;
+}
+static int chunk_to_array(RoarChunk *c){
+    unsigned short *a = (unsigned short*)malloc(sizeof *a * (size_t)(c->card ? c->card : 1));
+    if (!a) return 0;
+    int n=0;
+    for (int w=0; w<ROAR_WORDS; w++)
+        for (unsigned long long x=c->bits[w]; x; x &= x-1) a[n++] = (unsigned short)(w*64 + ctz64(x));
+    free(c->bits); c->bits=NULL; c->array=a; c->cap=c->card;
+    return 1;
+}
+static int roar_grow(Roaring *r){
+    if (r->n < r->cap) return 1;
+    int nc = r->cap ? r->cap*2 : 4;
+    RoarChunk *t = (RoarChunk*)realloc(r->chunks, sizeof *t * (size_t)nc);
+    if (!t) return 0;
+    r->chunks=t; r->cap=nc;
+    return 1;
+}
+/* Append a finished chunk (keys must arrive in ascending order). */
+static int roar_push(Roaring *r, RoarChunk *c){
+    if (!c->card){ chunk_free(c); return 1; }
+    if (!roar_grow(r)){ chunk_free(c); return 0; }
+    r->chunks[r->n++] = *c;
+    return 1;
+}
+
+int roar_add(Roaring *r, unsigned v){
+    unsigned key = v>>16, low = v&0xFFFFu;
+    int i = roar_find(r, key);
+    if (i < 0){
+        i = -i-1;
+        unsigned short *a = (unsigned short*)malloc(4*sizeof *a);
+        if (!a || !roar_grow(r)){ free(a); return 0; }
+        memmove(&r->chunks[i+1], &r->chunks[i], sizeof(RoarChunk) * (size_t)(r->n-i));
+        r->chunks[i] = (RoarChunk){ (unsigned short)key, 0, 4, a, NULL };
+        r->n++;
+    }
+    RoarChunk *c = &r->chunks[i];
+    if (c->bits){
+        unsigned long long *w = &c->bits[low>>6], m = 1ull << (low&63);
+        if (*w & m) return 0;
+        *w |= m; c->card++;
+        return 1;
+    }
+    int pos = chunk_lb(c, low);
+    if (pos < c->card && c->array[pos] == low) return 0;
+    if (c->card == ROAR_ARRAY_MAX){
+        if (!chunk_to_bits(c)) return 0;
+        c->bits[low>>6] |= 1ull << (low&63); c->card++;
+        return 1;
+    }
+    if (c->card == c->cap){
+        int nc = c->cap*2 < ROAR_ARRAY_MAX ? c->cap*2 : ROAR_ARRAY_MAX;
+        unsigned short *t = (unsigned short*)realloc(c->array, sizeof *t * (size_t)nc);
+        if (!t) return 0;
+        c->array=t; c->cap=nc;
+    }
+    memmove(&c->array[pos+1], &c->array[pos], sizeof *c->array * (size_t)(c->card-pos));
+    c->array[pos] = (unsigned short)low; c->card++;
+    return 1;
+}
+int roar_remove(Roaring *r, unsigned v){
+    unsigned low = v&0xFFFFu;
+    int i = roar_find(r, v>>16);
+    if (i < 0) return 0;
+    RoarChunk *c = &r->chunks[i];
+    if (c->bits){
+        unsigned long long *w = &c->bits[low>>6], m = 1ull << (low&63);
+        if (!(*w & m)) return 0;
+        *w &= ~m; c->card--;
+        if (c->card <= ROAR_ARRAY_MAX) chunk_to_array(c);   /* stays a bitmap if that fails */
+    } else {
+        int pos = chunk_lb(c, low);
+        if (pos >= c->card || c->array[pos] != low) return 0;
+        memmove(&c->array[pos], &c->array[pos+1], sizeof *c->array * (size_t)(c->card-pos-1));
+        c->card--;
+    }
+    if (!c->card){
+        chunk_free(c);
+        memmove(c, c+1, sizeof *c * (size_t)(r->n-1-i));
+        r->n--;
+    }
+    return 1;
+}
+int roar_contains(const Roaring *r, unsigned v){
+    int i = roar_find(r, v>>16);
+    if (i < 0) return 0;
+    const RoarChunk *c = &r->chunks[i];
+    unsigned low = v&0xFFFFu;
+    if (c->bits) return (int)(c->bits[low>>6] >> (low&63) & 1u);
+    int pos = chunk_lb(c, low);
+    return pos < c->card && c->array[pos] == low;
+}
+/* Smallest member >= from. Returns 0 when there is none. */
+int roar_next(const Roaring *r, unsigned from, unsigned *out){
+    int i = roar_find(r, from>>16);
+    unsigned low = from&0xFFFFu;
+    if (i < 0){ i = -i-1; low = 0; }
+    for (; i<r->n; i++, low=0){
+        const RoarChunk *c = &r->chunks[i];
+        unsigned base = (unsigned)c->key << 16;
+        if (c->bits){
+            int w = (int)(low>>6);
+            unsigned long long x = c->bits[w] & (~0ull << (low&63));
+            for (;;){
+                if (x){ *out = base | (unsigned)(w*64 + ctz64(x)); return 1; }
+                if (++w == ROAR_WORDS) break;
+                x = c->bits[w];
+            }
+        } else {
+            int pos = chunk_lb(c, low);
+            if (pos < c->card){ *out = base | c->array[pos]; return 1; }
+        }
+    }
+    return 0;
+}
+long roar_card(const Roaring *r){
+    long n=0; for (int i=0;i<r->n;i++) n += r->chunks[i].card;
+    return n;
+}
+/* Visit members in ascending order until fn returns 0. */
+void roar_foreach(const Roaring *r, int (*fn)(void *ctx, unsigned v), void *ctx){
+    for (int i=0;i<r->n;i++){
+        const RoarChunk *c = &r->chunks[i];
+        unsigned base = (unsigned)c->key << 16;
+        if (c->bits){
+            for (int w=0; w<ROAR_WORDS; w++)
+                for (unsigned long long x=c->bits[w]; x; x &= x-1)
+                    if (!fn(ctx, base | (unsigned)(w*64 + ctz64(x)))) return;
+        } else {
+            for (int k=0;k<c->card;k++) if (!fn(ctx, base | c->array[k])) return;
+        }
+    }
+}
+static int chunk_and(const RoarChunk *a, const RoarChunk *b, RoarChunk *out){
+    memset(out, 0, sizeof *out); out->key = a->key;
+    if (a->bits && b->bits){
+        if (!(out->bits = (unsigned long long*)malloc(sizeof *out->bits * ROAR_WORDS))) return 0;
+        for (int w=0; w<ROAR_WORDS; w++){ out->bits[w] = a->bits[w] & b->bits[w]; out->card += popcount64(out->bits[w]); }
+        if (out->card <= ROAR_ARRAY_MAX) chunk_to_array(out);
+        return 1;
+    }
+    if (a->bits){ const RoarChunk *t=a; a=b; b=t; }      /* a is an array */
+    out->cap = a->card ? a->card : 1;
+    if (!(out->array = (unsigned short*)malloc(sizeof *out->array * (size_t)out->cap))) return 0;
+    if (b->bits){
+        for (int i=0;i<a->card;i++)
+            if (b->bits[a->array[i]>>6] >> (a->array[i]&63) & 1u) out->array[out->card++] = a->array[i];
+    } else {
+        for (int i=0, j=0; i<a->card && j<b->card; ){
+            if (a->array[i] < b->array[j]) i++;
+            else if (a->array[i] > b->array[j]) j++;
+            else { out->array[out->card++] = a->array[i]; i++; j++; }
+        }
+    }
+    return 1;
+}
+/* out = a & b. `out` must be empty; returns 0 on allocation failure. */
+int roar_and(const Roaring *a, const Roaring *b, Roaring *out){
+    for (int i=0, j=0; i<a->n && j<b->n; ){
+        if (a->chunks[i].key < b->chunks[j].key) i++;
+        else if (a->chunks[i].key > b->chunks[j].key) j++;
+        else {
+            RoarChunk c;
+            if (!chunk_and(&a->chunks[i++], &b->chunks[j++], &c) || !roar_push(out, &c)){ chunk_free(&c); return 0; }
+        }
+    }
+    return 1;
+}
+size_t roar_bytes(const Roaring *r){
+    size_t n = sizeof(RoarChunk) * (size_t)r->cap;
+    for (int i=0;i<r->n;i++)
+        n += r->chunks[i].bits ? sizeof(unsigned long long)*ROAR_WORDS : sizeof(unsigned short)*(size_t)r->chunks[i].cap;
+    return n;
+}
+
+/* ====== Graph (Adjacency) ====== */
+void graph_init(Graph *g){
+    g->head=NULL; g->user_count=0;
+    g->names=NULL; g->slots=NULL; g->nnames=g->names_cap=g->slots_cap=0;
+}
+
+/* Name table: every name that appears as a vertex or an edge endpoint gets
+ * a dense id, so follow sets can be stored as id bitmaps. */
+static int graph_slot(const Graph *g, const NameKey *k){
+    unsigned mask = (unsigned)g->slots_cap-1;
+    for (unsigned i=user_hash(k->s)&mask;; i=(i+1)&mask){
+        int id = g->slots[i];
+        if (id < 0 || name_eq(g->names[id].s, k->s)) return (int)i;
+    }
+}
+int graph_name_id(const Graph *g, const char *name){
+    if (!g->slots_cap) return -1;
+    NameKey k; name_key(&k, name);
+    return g->slots[graph_slot(g,&k)];
+}
+int graph_intern(Graph *g, const char *name){
+    NameKey k; name_key(&k, name);
+    if (g->slots_cap){
+        int id = g->slots[graph_slot(g,&k)];
+        if (id >= 0) return id;
+    }
+    if ((g->nnames+1)*2 > g->slots_cap){
+        int nc = g->slots_cap ? g->slots_cap*2 : 64;
+        int *ns = (int*)malloc(sizeof(int)*(size_t)nc);
+        if (!ns) return -1;
+        free(g->slots); g->slots = ns; g->slots_cap = nc;
+        for (int i=0;i<nc;i++) ns[i] = -1;
+        for (int id=0; id<g->nnames; id++) ns[graph_slot(g,&g->names[id])] = id;
+    }
+    if (g->nnames == g->names_cap){
+        int nc = g->names_cap ? g->names_cap*2 : 64;
+        NameKey *nn = (NameKey*)realloc(g->names, sizeof(NameKey)*(size_t)nc);
+        if (!nn) return -1;
+        g->names = nn; g->names_cap = nc;
+    }
+    int id = g->nnames++;
+    g->names[id] = k;
+    g->slots[graph_slot(g,&k)] = id;
+    return id;
+}
+const char* graph_name(const Graph *g, int id){ return g->names[id].s; }
+
+GraphUser* graph_find(Graph *g, const char *username){
+    TRACE_SPAN("graph_find");
+    NameKey k; name_key(&k, username);
+    for (GraphUser *cu=g->head; cu; cu=cu->next)
+        if (name_eq(cu->username, k.s)) return cu;
+    return NULL;
+}
+static AdjNode* adj_prepend(AdjNode *head, const char *u){
+    AdjNode *n=(AdjNode*)malloc(sizeof(AdjNode));
+    if (!n) return head;
+    strncpy(n->username,u,USERNAME_MAX-1); n->username[USERNAME_MAX-1]='\0';
+    n->next=head; return n;
+}
+static int adj_has(const AdjNode *head, const char *u){
+    NameKey k; name_key(&k, u);
+    for (; head; head=head->next) if (name_eq(head->username,k.s)) return 1;
+    return 0;
+}
+static AdjNode* adj_remove(AdjNode *head, const char *u, int *removed){
+    AdjNode *cur=head,*prev=NULL; *removed=0;
+    NameKey k; name_key(&k, u);
+    while(cur){
+        if(name_eq(cur->username,k.s)){
+            *removed=1;
+            if(prev) prev->next=cur->next; else head=cur->next;
+            free(cur); break;
+        }
+        prev=cur; cur=cur->next;
+    }
+    return head;
+}
+static void adj_free(AdjNode *a){ while (a){ AdjNode *an=a->next; free(a); a=an; } }
+
+static int adjset_has(const Graph *g, const AdjSet *s, const char *u){
+    if (!s->bits) return adj_has(s->list, u);
+    int id = graph_name_id(g, u);
+    return id >= 0 && roar_contains(s->bits, (unsigned)id);
+}
+/* Move a set that outgrew its list into a bitmap. */
+static int adjset_promote(Graph *g, AdjSet *s){
+    Roaring *r = (Roaring*)malloc(sizeof *r);
+    if (!r) return 0;
+    roar_init(r);
+    for (AdjNode *a=s->list; a; a=a->next){
+        int id = graph_intern(g, a->username);
+        if (id < 0 || !roar_add(r, (unsigned)id)){ roar_free(r); free(r); return 0; }
+    }
+    adj_free(s->list); s->list = NULL; s->bits = r;
+    return 1;
+}
+static int adjset_add(Graph *g, AdjSet *s, const char *u){
+    if (adjset_has(g, s, u)) return 0;
+    int id = graph_intern(g, u);            /* every endpoint gets an id, listed or not */
+    if (id < 0) return 0;
+    if (!s->bits && s->count < ADJ_BITMAP_AT){
+        AdjNode *h = adj_prepend(s->list, u);
+        if (h == s->list) return 0;
+        s->list = h; s->count++;
+        return 1;
+    }
+    if (!s->bits && !adjset_promote(g, s)) return 0;
+    if (!roar_add(s->bits, (unsigned)id)) return 0;
+    s->count++;
+    return 1;
+}
+static int adjset_remove(const Graph *g, AdjSet *s, const char *u){
+    int r = 0;
+    if (!s->bits) s->list = adj_remove(s->list, u, &r);
+    else { int id = graph_name_id(g, u); r = id >= 0 && roar_remove(s->bits, (unsigned)id); }
+    if (r) s->count--;
+    return r;
+}
+static void adjset_free(AdjSet *s){
+    adj_free(s->list);
+    if (s->bits){ roar_free(s->bits); free(s->bits); }
+    s->list = NULL; s->bits = NULL; s->count = 0;
+}
+
+AdjSet* graph_adj(GraphUser *gu, int side){ return side==GRAPH_FOLLOWING ? &gu->following : &gu->followers; }
+int graph_degree(const GraphUser *gu, int side){ return side==GRAPH_FOLLOWING ? gu->following.count : gu->followers.count; }
+int graph_has(const Graph *g, const GraphUser *gu, int side, const char *name){
+    return adjset_has(g, side==GRAPH_FOLLOWING ? &gu->following : &gu->followers, name);
+}
+typedef struct AdjVisit { const Graph *g; int (*fn)(void *ctx, const char *name); void *ctx; } AdjVisit;
+static int adj_visit_id(void *ctx, unsigned id){
+    AdjVisit *v = (AdjVisit*)ctx;
+    return v->fn(v->ctx, v->g->names[id].s);
+}
+static void adjset_foreach(const Graph *g, const AdjSet *s, int (*fn)(void *ctx, const char *name), void *ctx){
+    if (s->bits){ AdjVisit v = { g, fn, ctx }; roar_foreach(s->bits, adj_visit_id, &v); return; }
+    for (const AdjNode *a=s->list; a; a=a->next) if (!fn(ctx, a->username)) return;
+}
+/* Visit every name on one side of gu until fn returns 0. */
+void graph_foreach(const Graph *g, const GraphUser *gu, int side, int (*fn)(void *ctx, const char *name), void *ctx){
+    adjset_foreach(g, side==GRAPH_FOLLOWING ? &gu->following : &gu->followers, fn, ctx);
+}
+typedef struct MutualCtx { const Graph *g; const AdjSet *other; int (*fn)(void *ctx, const char *name); void *ctx; int n, stop; } MutualCtx;
+static int mutual_probe(void *ctx, const char *name){
+    MutualCtx *m = (MutualCtx*)ctx;
+    if (!adjset_has(m->g, m->other, name)) return 1;
+    m->n++;
+    if (!m->fn(m->ctx, name)){ m->stop = 1; return 0; }
+    return 1;
+}
+static int mutual_id(void *ctx, unsigned id){
+    MutualCtx *m = (MutualCtx*)ctx;
+    m->n++;
+    return m->fn(m->ctx, m->g->names[id].s);
+}
+/* Users gu follows who also follow gu back. Two bitmaps are intersected
+ * directly; otherwise the smaller side is probed against the larger. */
+int graph_mutual(const Graph *g, const GraphUser *gu, int (*fn)(void *ctx, const char *name), void *ctx){
+    const AdjSet *a = &gu->following, *b = &gu->followers;
+    MutualCtx m = { g, NULL, fn, ctx, 0, 0 };
+    if (a->bits && b->bits){
+        Roaring both; roar_init(&both);
+        if (roar_and(a->bits, b->bits, &both)){ roar_foreach(&both, mutual_id, &m); roar_free(&both); return m.n; }
+        roar_free(&both);
+    }
+    if (a->count > b->count){ const AdjSet *t=a; a=b; b=t; }
+    m.other = b;
+    adjset_foreach(g, a, mutual_probe, &m);
+    return m.n;
+}
+
+/* Keep only each current follower's latest follow, still in time order. */
+static void follow_log_compact(const Graph *g, GraphUser *gu){
+    FollowLog *l = &gu->follow_log;
+    Roaring seen; roar_init(&seen);
+    int w = l->n;
+    for (int i=l->n-1; i>=0; i--){              /* newest first; fill from the back */
+        FollowEvent e = l->ev[i];
+        int id = e.who >= 0 ? e.who : ~e.who;
+        if (!roar_add(&seen, (unsigned)id)) continue;
+        if (e.who >= 0 && adjset_has(g, &gu->followers, g->names[id].s)) l->ev[--w] = e;
+    }
+    roar_free(&seen);
+    memmove(l->ev, l->ev + w, sizeof *l->ev * (size_t)(l->n - w));
+    l->n -= w;
+}
+void graph_log_append(Graph *g, GraphUser *gu, const char *who, unsigned t, int follow){
+    FollowLog *l = &gu->follow_log;
+    int id = graph_intern(g, who);
+    if (id < 0) return;
+    if (l->n == l->cap){
+        if (gu->followers.count*2 <= l->n && l->n >= 64) follow_log_compact(g, gu);
+        if (l->n == l->cap){
+            int nc = l->cap ? l->cap*2 : 8;
+            FollowEvent *ne = (FollowEvent*)realloc(l->ev, sizeof *ne * (size_t)nc);
+            if (!ne) return;
+            l->ev = ne; l->cap = nc;
+        }
+    }
+    if (l->n && t < l->ev[l->n-1].t) t = l->ev[l->n-1].t;   /* clock stepped back */
+    l->ev[l->n].t = t; l->ev[l->n].who = follow ? id : ~id;
+    l->n++;
+}
+/* Current followers whose latest follow is at or after `since`, newest
+ * first: binary search for the first event >= since, then scan from the
+ * end back to it, reporting each follower once. Returns how many. */
+int graph_followers_since(const Graph *g, const GraphUser *gu, unsigned since,
+                          int (*fn)(void *ctx, const char *name, unsigned t), void *ctx){
+    const FollowLog *l = &gu->follow_log;
+    int lo = 0, hi = l->n;
+    while (lo < hi){ int mid = (lo+hi)/2; if (l->ev[mid].t < since) lo = mid+1; else hi = mid; }
+    Roaring seen; roar_init(&seen);
+    int n = 0;
+    for (int i=l->n-1; i>=lo; i--){
+        FollowEvent e = l->ev[i];
+        int id = e.who >= 0 ? e.who : ~e.who;
+        if (!roar_add(&seen, (unsigned)id) || e.who < 0) continue;
+        if (!adjset_has(g, &gu->followers, g->names[id].s)) continue;
+        n++;
+        if (!fn(ctx, g->names[id].s, e.t)) break;
+    }
+    roar_free(&seen);
+    return n;
+}
+
+void graph_cursor(AdjCursor *c, const Graph *g, const GraphUser *gu, int side){
+    c->g = g; c->set = side==GRAPH_FOLLOWING ? &gu->following : &gu->followers;
+    c->node = c->set->list; c->next_id = 0; c->done = 0;
+}
+const char* graph_cursor_next(AdjCursor *c){
+    if (c->done) return NULL;
+    if (!c->set->bits){
+        if (!c->node){ c->done = 1; return NULL; }
+        const char *name = c->node->username;
+        c->node = c->node->next;
+        return name;
+    }
+    unsigned id;
+    if (!roar_next(c->set->bits, c->next_id, &id)){ c->done = 1; return NULL; }
+    c->next_id = id+1;
+    if (!c->next_id) c->done = 1;       /* wrapped past UINT_MAX */
+    return c->g->names[id].s;
+}
+
+/* No cap here: the user limit is app policy (app->max_users, checked on
+ * registration), and store-backed users faulted in from disk must always
+ * get a vertex. */
+int graph_add_user(Graph *g, const char *username){
+    if (graph_find(g, username)) return 1;
+    int id = graph_intern(g, username);
+    if (id < 0) return 0;
+    GraphUser *nu=(GraphUser*)calloc(1,sizeof(GraphUser));
+    if (!nu) return 0;
+    strncpy(nu->username, username, USERNAME_MAX-1);
+    nu->id = id;
+    nu->next = g->head; g->head = nu; g->user_count++;
+    return 1;
+}
+/* `when` stamps the follower-side log; replicas pass the leader's time. */
+int graph_add_edge(Graph *g, const char *from, const char *to, unsigned when){
+    TRACE_SPAN("graph_add_edge");
+    GraphUser *A=graph_find(g,from), *B=graph_find(g,to);
+    if (!A||!B || strcmp(from,to)==0) return 0;
+    adjset_add(g, &A->following, to);
+    if (adjset_add(g, &B->followers, from)) graph_log_append(g, B, from, when, 1);
+    return 1;
+}
+int graph_remove_edge(Graph *g, const char *from, const char *to, unsigned when){
+    TRACE_SPAN("graph_remove_edge");
+    GraphUser *A=graph_find(g,from), *B=graph_find(g,to);
+    if (!A||!B) return 0;
+    int r1 = adjset_remove(g, &A->following, to);
+    int r2 = adjset_remove(g, &B->followers, from);
+    if (r2) graph_log_append(g, B, from, when, 0);
+    return r1&&r2;
+}
+typedef struct EdgeTarget { int id, idx; GraphUser *gu; } EdgeTarget;
+static int edge_target_cmp(const void *a, const void *b){
+    int x = ((const EdgeTarget*)a)->id, y = ((const EdgeTarget*)b)->id;
+    return (x > y) - (x < y);
+}
+/* Add (or remove) from -> to[i] for every target in one pass: targets are
+ * mapped to name ids and sorted, duplicates dropped, and all endpoints are
+ * resolved by a single walk of the user list instead of one per edge.
+ * changed[i] (optional) is set for each edge that was added or removed.
+ * Returns how many changed. */
+int graph_edges_many(Graph *g, const char *from, const char *const *to, int n, int follow, unsigned when, unsigned char *changed){
+    TRACE_SPAN("graph_edges_many");
+    GraphUser *A = graph_find(g, from);
+    if (changed) memset(changed, 0, (size_t)(n > 0 ? n : 0));
+    if (!A || n <= 0) return 0;
+    EdgeTarget *t = (EdgeTarget*)malloc(sizeof *t * (size_t)n);
+    if (!t) return 0;
+    int m = 0;
+    for (int i=0;i<n;i++){
+        int id = graph_name_id(g, to[i]);  /* every user is interned; unknown names are skipped */
+        if (id < 0 || id == A->id) continue;
+        t[m].id = id; t[m].idx = i; t[m].gu = NULL; m++;
+    }
+    qsort(t, (size_t)m, sizeof *t, edge_target_cmp);
+    int u = 0;
+    for (int i=0;i<m;i++) if (!u || t[u-1].id != t[i].id) t[u++] = t[i];
+    int left = u;
+    for (GraphUser *cu=g->head; cu && left; cu=cu->next){
+        int lo = 0, hi = u;
+        while (lo < hi){ int mid=(lo+hi)/2; if (t[mid].id < cu->id) lo = mid+1; else hi = mid; }
+        if (lo < u && t[lo].id == cu->id && !t[lo].gu){ t[lo].gu = cu; left--; }
+    }
+    int done = 0;
+    for (int i=0;i<u;i++){
+        GraphUser *B = t[i].gu;
+        if (!B) continue;
+        NameKey k = g->names[t[i].id];     /* interning may move g->names */
+        const char *name = k.s;
+        int ok;
+        if (follow){
+            ok = adjset_add(g, &A->following, name);
+            if (adjset_add(g, &B->followers, from)) graph_log_append(g, B, from, when, 1);
+        } else {
+            ok = adjset_remove(g, &A->following, name);
+            if (adjset_remove(g, &B->followers, from)) graph_log_append(g, B, from, when, 0);
+            else ok = 0;
+        }
+        if (ok){ done++; if (changed) changed[t[i].idx] = 1; }
+    }
+    free(t);
+    return done;
+}
+/* One side of an edge, for shards that own only one endpoint. */
+int graph_add_half_edge(Graph *g, const char *owner, const char *other, int side){
+    TRACE_SPAN("graph_add_half_edge");
+    GraphUser *gu=graph_find(g,owner);
+    if (!gu || strcmp(owner,other)==0) return 0;
+    if (!adjset_add(g, graph_adj(gu,side), other)) return 0;
+    if (side == GRAPH_FOLLOWERS) graph_log_append(g, gu, other, (unsigned)time(NULL), 1);
+    return 1;
+}
+int graph_remove_half_edge(Graph *g, const char *owner, const char *other, int side){
+    TRACE_SPAN("graph_remove_half_edge");
+    GraphUser *gu=graph_find(g,owner);
+    if (!gu || !adjset_remove(g, graph_adj(gu,side), other)) return 0;
+    if (side == GRAPH_FOLLOWERS) graph_log_append(g, gu, other, (unsigned)time(NULL), 0);
+    return 1;
+}
+static int show_name(void *ctx, const char *name){ (void)ctx; out_printf(" - %s\n", name); return 1; }
+void graph_free(Graph *g){
+    GraphUser *cu=g->head;
+    while(cu){
+        GraphUser *nx=cu->next;
+        adjset_free(&cu->following);
+        adjset_free(&cu->followers);
+        free(cu->follow_log.ev);
+        sb_free(&cu->feed);
+        free(cu); cu=nx;
+    }
+    free(g->names); free(g->slots);
+    graph_init(g);
+}
+
+/* ====== Graph analytics (CSR snapshot) ====== */
+void csr_free(Csr *c){
+    free(c->off); free(c->adj); free(c->orig);
+    memset(c, 0, sizeof *c);
+}
+/* Build from an edge list in O(n+m): two counting-sort passes (by target,
+ * then stably by source) leave every row sorted, then duplicates and self
+ * loops are squeezed out. orig is the identity. */
+int csr_from_edges(Csr *c, int n, const int *src, const int *dst, long m){
+    memset(c, 0, sizeof *c);
+    long *cnt = (long*)calloc((size_t)n+1, sizeof *cnt);
+    long *tmp = (long*)malloc(sizeof(long)*(size_t)(m ? m : 1));
+    c->off = (long*)calloc((size_t)n+1, sizeof *c->off);
+    c->adj = (int*)malloc(sizeof(int)*(size_t)(m ? m : 1));
+    c->orig = (int*)malloc(sizeof(int)*(size_t)(n ? n : 1));
+    if (!cnt || !tmp || !c->off || !c->adj || !c->orig){ free(cnt); free(tmp); csr_free(c); return 0; }
+    c->n = n;
+    for (int v=0; v<n; v++) c->orig[v] = v;
+
+    for (long e=0; e<m; e++) cnt[dst[e]+1]++;
+    for (int v=0; v<n; v++) cnt[v+1] += cnt[v];
+    for (long e=0; e<m; e++) tmp[cnt[dst[e]]++] = e;             /* edge ids by target */
+
+    for (long e=0; e<m; e++) c->off[src[e]+1]++;
+    for (int v=0; v<n; v++) c->off[v+1] += c->off[v];
+    memcpy(cnt, c->off, sizeof *cnt * (size_t)(n+1));
+    for (long i=0; i<m; i++){ long e = tmp[i]; c->adj[cnt[src[e]]++] = dst[e]; }
+
+    long w = 0;
+    for (int v=0; v<n; v++){
+        long b = c->off[v], end = c->off[v+1];
+        c->off[v] = w;
+        for (long i=b; i<end; i++)
+            if (c->adj[i] != v && (w == c->off[v] || c->adj[i] != c->adj[w-1])) c->adj[w++] = c->adj[i];
+    }
+    c->off[n] = c->m = w;
+    free(cnt); free(tmp);
+    return 1;
+}
+typedef struct EdgeSink { const Graph *g; int self, outward; int *src, *dst; long m; } EdgeSink;
+static int edge_sink(void *ctx, const char *name){
+    EdgeSink *s = (EdgeSink*)ctx;
+    int other = graph_name_id(s->g, name);
+    if (other < 0) return 1;
+    s->src[s->m] = s->outward ? s->self : other;
+    s->dst[s->m] = s->outward ? other : s->self;
+    s->m++;
+    return 1;
+}
+/* Snapshot every follow edge the graph knows about. Vertices are all the
+ * names in the graph's table; edges come from both sides of each local
+ * user, so half edges held by a shard are included too. */
+int csr_build(Csr *c, const Graph *g){
+    TRACE_SPAN("csr_build");
+    long m = 0;
+    for (const GraphUser *gu=g->head; gu; gu=gu->next) m += gu->following.count + gu->followers.count;
+    EdgeSink s = { g, 0, 0, (int*)malloc(sizeof(int)*(size_t)(m ? m : 1)), (int*)malloc(sizeof(int)*(size_t)(m ? m : 1)), 0 };
+    if (!s.src || !s.dst){ free(s.src); free(s.dst); return 0; }
+    for (const GraphUser *gu=g->head; gu; gu=gu->next){
+        s.self = gu->id;
+        s.outward = 1; graph_foreach(g, gu, GRAPH_FOLLOWING, edge_sink, &s);
+        s.outward = 0; graph_foreach(g, gu, GRAPH_FOLLOWERS, edge_sink, &s);
+    }
+    int ok = csr_from_edges(c, g->nnames, s.src, s.dst, s.m);
+    free(s.src); free(s.dst);
+    return ok;
+}
+
+/* Renumbering for locality: returns perm with perm[old] = new.
+ * CSR_ORDER_DEGREE puts hubs first (bucketed by out-degree, O(n+m)).
+ * CSR_ORDER_BFS numbers vertices in breadth-first visit order, starting
+ * each new tree at the highest-degree unvisited vertex, so a vertex's
+ * neighbours mostly land in a nearby id range. */
+static int* csr_degree_rank(const Csr *c){
+    long maxd = 0;
+    for (int v=0; v<c->n; v++){ long d = c->off[v+1]-c->off[v]; if (d > maxd) maxd = d; }
+    long *bucket = (long*)calloc((size_t)maxd+2, sizeof *bucket);
+    int *byrank = (int*)malloc(sizeof(int)*(size_t)(c->n ? c->n : 1));
+    if (!bucket || !byrank){ free(bucket); free(byrank); return NULL; }
+    for (int v=0; v<c->n; v++) bucket[maxd - (c->off[v+1]-c->off[v]) + 1]++;
+    for (long d=0; d<=maxd; d++) bucket[d+1] += bucket[d];
+    for (int v=0; v<c->n; v++) byrank[bucket[maxd - (c->off[v+1]-c->off[v])]++] = v;
+    free(bucket);
+    return byrank;                          /* vertices, highest degree first */
+}
+int* csr_order(const Csr *c, int how){
+    int *byrank = csr_degree_rank(c);
+    int *perm = (int*)malloc(sizeof(int)*(size_t)(c->n ? c->n : 1));
+    if (!byrank || !perm){ free(byrank); free(perm); return NULL; }
+    if (how == CSR_ORDER_DEGREE){
+        for (int r=0; r<c->n; r++) perm[byrank[r]] = r;
+        free(byrank);
+        return perm;
+    }
+    int *queue = (int*)malloc(sizeof(int)*(size_t)(c->n ? c->n : 1));
+    if (!queue){ free(byrank); free(perm); return NULL; }
+    for (int v=0; v<c->n; v++) perm[v] = -1;
+    int next = 0;
+    for (int r=0; r<c->n; r++){
+        int root = byrank[r];
+        if (perm[root] >= 0) continue;
+        int head = 0, tail = 0;
+        perm[root] = next++; queue[tail++] = root;
+        while (head < tail){
+            int u = queue[head++];
+            for (long i=c->off[u]; i<c->off[u+1]; i++){
+                int v = c->adj[i];
+                if (perm[v] < 0){ perm[v] = next++; queue[tail++] = v; }
+            }
+        }
+    }
+    free(queue); free(byrank);
+    return perm;
+}
+int csr_permute(const Csr *in, const int *perm, Csr *out){
+    int *src = (int*)malloc(sizeof(int)*(size_t)(in->m ? in->m : 1));
+    int *dst = (int*)malloc(sizeof(int)*(size_t)(in->m ? in->m : 1));
+    if (!src || !dst){ free(src); free(dst); return 0; }
+    for (int u=0; u<in->n; u++)
+        for (long i=in->off[u]; i<in->off[u+1]; i++){ src[i] = perm[u]; dst[i] = perm[in->adj[i]]; }
+    int ok = csr_from_edges(out, in->n, src, dst, in->m);
+    free(src); free(dst);
+    if (ok) for (int u=0; u<in->n; u++) out->orig[perm[u]] = in->orig[u];
+    return ok;
+}
+
+/* Hop counts from src along follow edges (-1 = unreachable). Returns the
+ * number of vertices reached. */
+int csr_bfs(const Csr *c, int src, int *dist){
+    int *queue = (int*)malloc(sizeof(int)*(size_t)(c->n ? c->n : 1));
+    if (!queue) return 0;
+    for (int v=0; v<c->n; v++) dist[v] = -1;
+    int head = 0, tail = 0;
+    dist[src] = 0; queue[tail++] = src;
+    while (head < tail){
+        int u = queue[head++];
+        for (long i=c->off[u]; i<c->off[u+1]; i++){
+            int v = c->adj[i];
+            if (dist[v] < 0){ dist[v] = dist[u]+1; queue[tail++] = v; }
+        }
+    }
+    free(queue);
+    return tail;
+}
+/* Push-style PageRank; rank from dangling vertices is spread evenly. */
+void csr_pagerank(const Csr *c, int iters, double damping, double *rank){
+    if (!c->n) return;
+    double *next = (double*)malloc(sizeof(double)*(size_t)c->n);
+    if (!next) return;
+    for (int v=0; v<c->n; v++) rank[v] = 1.0/c->n;
+    for (int it=0; it<iters; it++){
+        double dangling = 0;
+        for (int v=0; v<c->n; v++) next[v] = 0;
+        for (int u=0; u<c->n; u++){
+            long d = c->off[u+1]-c->off[u];
+            if (!d){ dangling += rank[u]; continue; }
+            double share = rank[u]/(double)d;
+            for (long i=c->off[u]; i<c->off[u+1]; i++) next[c->adj[i]] += share;
+        }
+        double base = (1.0-damping)/c->n + damping*dangling/c->n;
+        for (int v=0; v<c->n; v++) rank[v] = base + damping*next[v];
+    }
+    free(next);
+}
+
+/* Worker threads for analytics kernels. par_for hands out [lo,hi) vertex
+ * chunks from a shared counter so a few hubs cannot stall one thread. */
+#define PAR_CHUNK 1024
+int analytics_threads(void){
+#ifdef _WIN32
+    return 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+typedef struct ParJob {
+    void (*fn)(void *ctx, int lo, int hi);
+    void *ctx;
+    int n;
+    _Atomic int next;
+} ParJob;
+static void* par_worker(void *arg){
+    ParJob *j = (ParJob*)arg;
+    for (;;){
+        int lo = atomic_fetch_add_explicit(&j->next, PAR_CHUNK, memory_order_relaxed);
+        if (lo >= j->n) return NULL;
+        j->fn(j->ctx, lo, lo+PAR_CHUNK < j->n ? lo+PAR_CHUNK : j->n);
+    }
+}
+static void par_for(int threads, int n, void (*fn)(void *ctx, int lo, int hi), void *ctx){
+    ParJob j; j.fn = fn; j.ctx = ctx; j.n = n; atomic_init(&j.next, 0);
+    pthread_t tid[64];
+    int started = 0;
+    if (threads > 64) threads = 64;
+    for (; started < threads-1; started++)
+        if (pthread_create(&tid[started], NULL, par_worker, &j) != 0) break;
+    par_worker(&j);                         /* the caller is a worker too */
+    for (int i=0;i<started;i++) pthread_join(tid[i], NULL);
+}
+
+/* Same vertices with every edge in both directions. */
+int csr_symmetric(const Csr *c, Csr *out){
+    long m2 = c->m*2;
+    int *src = (int*)malloc(sizeof(int)*(size_t)(m2 ? m2 : 1));
+    int *dst = (int*)malloc(sizeof(int)*(size_t)(m2 ? m2 : 1));
+    if (!src || !dst){ free(src); free(dst); return 0; }
+    for (int u=0; u<c->n; u++)
+        for (long i=c->off[u]; i<c->off[u+1]; i++){
+            src[2*i] = u; dst[2*i] = c->adj[i];
+            src[2*i+1] = c->adj[i]; dst[2*i+1] = u;
+        }
+    int ok = csr_from_edges(out, c->n, src, dst, m2);
+    free(src); free(dst);
+    if (ok) memcpy(out->orig, c->orig, sizeof(int)*(size_t)c->n);
+    return ok;
+}
+
+/* Connected components (follow direction ignored) by concurrent union-find.
+ * Roots are only ever hooked under a smaller id with a CAS, so parent[v] <= v
+ * and the forest stays acyclic without locks; finds halve paths as they go.
+ * comp[v] is the smallest vertex in v's component. Returns the count. */
+static int uf_find(_Atomic int *parent, int v){
+    for (;;){
+        int p = atomic_load_explicit(&parent[v], memory_order_relaxed);
+        if (p == v) return v;
+        int gp = atomic_load_explicit(&parent[p], memory_order_relaxed);
+        if (gp != p) atomic_compare_exchange_weak_explicit(&parent[v], &p, gp, memory_order_relaxed, memory_order_relaxed);
+        v = gp;
+    }
+}
+static void uf_union(_Atomic int *parent, int a, int b){
+    for (;;){
+        a = uf_find(parent, a); b = uf_find(parent, b);
+        if (a == b) return;
+        if (a < b){ int t=a; a=b; b=t; }
+        int expect = a;
+        if (atomic_compare_exchange_strong_explicit(&parent[a], &expect, b, memory_order_relaxed, memory_order_relaxed)) return;
+    }
+}
+typedef struct CcCtx { const Csr *c; _Atomic int *parent; int *comp; } CcCtx;
+static void cc_link(void *ctx, int lo, int hi){
+    CcCtx *x = (CcCtx*)ctx;
+    for (int u=lo; u<hi; u++)
+        for (long i=x->c->off[u]; i<x->c->off[u+1]; i++) uf_union(x->parent, u, x->c->adj[i]);
+}
+static void cc_label(void *ctx, int lo, int hi){
+    CcCtx *x = (CcCtx*)ctx;
+    for (int v=lo; v<hi; v++) x->comp[v] = uf_find(x->parent, v);
+}
+int csr_components(const Csr *c, int threads, int *comp){
+    _Atomic int *parent = (_Atomic int*)malloc(sizeof(_Atomic int)*(size_t)(c->n ? c->n : 1));
+    if (!parent) return -1;
+    for (int v=0; v<c->n; v++) atomic_init(&parent[v], v);
+    CcCtx x = { c, parent, comp };
+    par_for(threads, c->n, cc_link, &x);
+    par_for(threads, c->n, cc_label, &x);
+    free(parent);
+    int count = 0;
+    for (int v=0; v<c->n; v++) count += comp[v] == v;
+    return count;
+}
+
+/* Community detection by synchronous label propagation over a symmetric
+ * snapshot: every round each vertex takes the most common label among
+ * itself and its neighbours, smallest label on a tie (which keeps pairs
+ * from swapping labels forever), reading last round's labels so threads
+ * never race. Stops when under 0.1% of vertices change or after
+ * max_iters rounds. Returns the number of rounds run. */
+typedef struct LpCtx { const Csr *s; const int *cur; int *next; _Atomic long changed; } LpCtx;
+static int cmp_int(const void *a, const void *b){ int x=*(const int*)a, y=*(const int*)b; return (x>y)-(x<y); }
+static void lp_round(void *ctx, int lo, int hi){
+    LpCtx *x = (LpCtx*)ctx;
+    long maxd = 0;
+    for (int v=lo; v<hi; v++) if (x->s->off[v+1]-x->s->off[v] > maxd) maxd = x->s->off[v+1]-x->s->off[v];
+    int *buf = (int*)malloc(sizeof(int)*(size_t)(maxd+1));
+    long changed = 0;
+    for (int v=lo; v<hi; v++){
+        int own = x->cur[v], best = own, bestn = 0;
+        long d = x->s->off[v+1]-x->s->off[v];
+        if (!buf || !d){ x->next[v] = own; continue; }
+        for (long i=0;i<d;i++) buf[i] = x->cur[x->s->adj[x->s->off[v]+i]];
+        buf[d++] = own;
+        if (d > 32) qsort(buf, (size_t)d, sizeof *buf, cmp_int);
+        else for (long i=1;i<d;i++){                    /* typical degrees: insertion sort */
+            int t = buf[i]; long j = i;
+            while (j > 0 && buf[j-1] > t){ buf[j] = buf[j-1]; j--; }
+            buf[j] = t;
+        }
+        for (long i=0;i<d;){
+            long j = i; while (j<d && buf[j]==buf[i]) j++;
+            if ((int)(j-i) > bestn){ bestn = (int)(j-i); best = buf[i]; }
+            i = j;
+        }
+        x->next[v] = best;
+        changed += best != own;
+    }
+    free(buf);
+    atomic_fetch_add_explicit(&x->changed, changed, memory_order_relaxed);
+}
+int csr_label_propagation(const Csr *sym, int threads, int max_iters, int *label){
+    int *tmp = (int*)malloc(sizeof(int)*(size_t)(sym->n ? sym->n : 1));
+    if (!tmp) return -1;
+    for (int v=0; v<sym->n; v++) label[v] = v;
+    int *cur = label, *next = tmp, rounds = 0;
+    while (rounds < max_iters){
+        LpCtx x; x.s = sym; x.cur = cur; x.next = next; atomic_init(&x.changed, 0);
+        par_for(threads, sym->n, lp_round, &x);
+        int *t = cur; cur = next; next = t;
+        rounds++;
+        if (atomic_load(&x.changed)*1000 <= sym->n) break;
+    }
+    if (cur != label) memcpy(label, cur, sizeof(int)*(size_t)sym->n);
+    free(tmp);
+    return rounds;
+}
+
+/* Triangles over a symmetric snapshot. Each undirected edge is kept only
+ * from its lower- to its higher-degree end (ties by id), so hubs have
+ * short out-lists and every triangle is found exactly once, by merging
+ * the sorted out-lists of its two lowest-ranked corners. tri[v] (optional)
+ * receives the triangles through v. Returns the total, or -1 on OOM. */
+typedef struct TriCtx { const Csr *s; const long *off; const int *adj; _Atomic long *tri; _Atomic long total; } TriCtx;
+static int tri_above(const Csr *s, int v, int w){
+    long dv = s->off[v+1]-s->off[v], dw = s->off[w+1]-s->off[w];
+    return dw > dv || (dw == dv && w > v);
+}
+static void tri_count(void *ctx, int lo, int hi){
+    TriCtx *x = (TriCtx*)ctx;
+    long total = 0;
+    for (int u=lo; u<hi; u++){
+        for (long i=x->off[u]; i<x->off[u+1]; i++){
+            int v = x->adj[i];
+            long a = x->off[u], ae = x->off[u+1], b = x->off[v], be = x->off[v+1];
+            while (a < ae && b < be){
+                if (x->adj[a] < x->adj[b]) a++;
+                else if (x->adj[a] > x->adj[b]) b++;
+                else {
+                    total++;
+                    if (x->tri){
+                        atomic_fetch_add_explicit(&x->tri[u], 1, memory_order_relaxed);
+                        atomic_fetch_add_explicit(&x->tri[v], 1, memory_order_relaxed);
+                        atomic_fetch_add_explicit(&x->tri[x->adj[a]], 1, memory_order_relaxed);
+                    }
+                    a++; b++;
+                }
+            }
+        }
+    }
+    atomic_fetch_add_explicit(&x->total, total, memory_order_relaxed);
+}
+long csr_triangles(const Csr *sym, int threads, long *tri){
+    long *off = (long*)malloc(sizeof(long)*(size_t)(sym->n+1));
+    int *adj = (int*)malloc(sizeof(int)*(size_t)(sym->m/2+1));
+    _Atomic long *counts = tri ? (_Atomic long*)malloc(sizeof(_Atomic long)*(size_t)(sym->n ? sym->n : 1)) : NULL;
+    if (!off || !adj || (tri && !counts)){ free(off); free(adj); free(counts); return -1; }
+    long w = 0;
+    for (int v=0; v<sym->n; v++){
+        off[v] = w;
+        for (long i=sym->off[v]; i<sym->off[v+1]; i++)
+            if (tri_above(sym, v, sym->adj[i])) adj[w++] = sym->adj[i];
+    }
+    off[sym->n] = w;
+    if (counts) for (int v=0; v<sym->n; v++) atomic_init(&counts[v], 0);
+    TriCtx x; x.s = sym; x.off = off; x.adj = adj; x.tri = counts; atomic_init(&x.total, 0);
+    par_for(threads, sym->n, tri_count, &x);
+    if (tri) for (int v=0; v<sym->n; v++) tri[v] = atomic_load_explicit(&counts[v], memory_order_relaxed);
+    free(off); free(adj); free(counts);
+    return atomic_load(&x.total);
+}
+/* Share of v's neighbour pairs that are themselves connected. */
+double csr_clustering(const Csr *sym, const long *tri, int v){
+    long d = sym->off[v+1]-sym->off[v];
+    return d < 2 ? 0.0 : 2.0*(double)tri[v]/((double)d*(double)(d-1));
+}
+
+/* K-core decomposition by bucket peeling (Batagelj-Zaversnik, O(n+m)):
+ * repeatedly remove a vertex of least remaining degree; the degree it has
+ * when removed is its coreness. core[v] is filled in; returns the largest. */
+int csr_kcore(const Csr *sym, int *core){
+    int n = sym->n, maxd = 0;
+    for (int v=0; v<n; v++){ core[v] = (int)(sym->off[v+1]-sym->off[v]); if (core[v] > maxd) maxd = core[v]; }
+    int *bin = (int*)calloc((size_t)maxd+1, sizeof *bin);
+    int *pos = (int*)malloc(sizeof(int)*(size_t)(n ? n : 1));
+    int *vert = (int*)malloc(sizeof(int)*(size_t)(n ? n : 1));
+    if (!bin || !pos || !vert){ free(bin); free(pos); free(vert); return -1; }
+    for (int v=0; v<n; v++) bin[core[v]]++;
+    for (int d=0, start=0; d<=maxd; d++){ int k = bin[d]; bin[d] = start; start += k; }
+    for (int v=0; v<n; v++){ pos[v] = bin[core[v]]++; vert[pos[v]] = v; }
+    for (int d=maxd; d>0; d--) bin[d] = bin[d-1];
+    bin[0] = 0;
+    int top = 0;
+    for (int i=0; i<n; i++){
+        int v = vert[i];
+        if (core[v] > top) top = core[v];
+        for (long k=sym->off[v]; k<sym->off[v+1]; k++){
+            int u = sym->adj[k];
+            if (core[u] <= core[v]) continue;
+            int du = core[u], pu = pos[u], pw = bin[du], w = vert[pw];
+            if (u != w){ pos[u] = pw; vert[pu] = w; pos[w] = pu; vert[pw] = u; }
+            bin[du]++; core[u]--;
+        }
+    }
+    free(bin); free(pos); free(vert);
+    return top;
+}
+
+/* ====== Pub/Sub (push new posts to followers) ====== */
+void pubsub_init(PubSub *ps){ ps->head=NULL; ps->count=0; }
+
+Subscriber* pubsub_find(PubSub *ps, const char *username){
+    for (Subscriber *s=ps->head; s; s=s->next)
+        if (strcmp(s->username, username)==0) return s;
+    return NULL;
+}
+Subscriber* pubsub_subscribe(PubSub *ps, const char *username){
+    Subscriber *s = pubsub_find(ps, username);
+    if (s) return s;
+    s=(Subscriber*)calloc(1,sizeof(Subscriber));
+    if (!s) return NULL;
+    strncpy(s->username, username, USERNAME_MAX-1);
+    atomic_init(&s->q.head, 0); atomic_init(&s->q.tail, 0);
+    s->next = ps->head; ps->head = s; ps->count++;
+    return s;
+}
+void pubsub_unsubscribe(PubSub *ps, const char *username){
+    Subscriber *cur=ps->head, *prev=NULL;
+    while (cur){
+        if (strcmp(cur->username, username)==0){
+            if (prev) prev->next=cur->next; else ps->head=cur->next;
+            free(cur); ps->count--; return;
+        }
+        prev=cur; cur=cur->next;
+    }
+}
+static int subq_push(SubQueue *q, int id){
+    unsigned t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned h = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (t - h == SUB_QUEUE_CAP) return 0;
+    q->ids[t & (SUB_QUEUE_CAP-1)] = id;
+    atomic_store_explicit(&q->tail, t+1, memory_order_release);
+    return 1;
+}
+typedef struct PublishCtx { PubSub *ps; int post_id, n; } PublishCtx;
+static void publish_to(PublishCtx *pc, Subscriber *s){
+    if (subq_push(&s->q, pc->post_id)) pc->n++; else s->dropped++;
+}
+static int publish_follower(void *ctx, const char *name){
+    PublishCtx *pc = (PublishCtx*)ctx;
+    Subscriber *s = pubsub_find(pc->ps, name);
+    if (s) publish_to(pc, s);
+    return 1;
+}
+/* Fan a new post out to every subscribed follower of its author: the
+ * intersection of followers and subscribers, walked from whichever side
+ * is smaller. Returns the number of queues the id was pushed to. */
+int pubsub_publish(PubSub *ps, Graph *g, const Post *p){
+    if (!ps->head) return 0;
+    GraphUser *gu = graph_find(g, p->author);
+    if (!gu) return 0;
+    PublishCtx pc = { ps, p->id, 0 };
+    if (ps->count < graph_degree(gu, GRAPH_FOLLOWERS)){
+        for (Subscriber *s=ps->head; s; s=s->next)
+            if (graph_has(g, gu, GRAPH_FOLLOWERS, s->username)) publish_to(&pc, s);
+    } else graph_foreach(g, gu, GRAPH_FOLLOWERS, publish_follower, &pc);
+    return pc.n;
+}
+/* Consumer side: pop the oldest pending post id. Returns 0 when empty. */
+int pubsub_poll(Subscriber *s, int *post_id){
+    unsigned h = atomic_load_explicit(&s->q.head, memory_order_relaxed);
+    unsigned t = atomic_load_explicit(&s->q.tail, memory_order_acquire);
+    if (h == t) return 0;
+    *post_id = s->q.ids[h & (SUB_QUEUE_CAP-1)];
+    atomic_store_explicit(&s->q.head, h+1, memory_order_release);
+    return 1;
+}
+void pubsub_free(PubSub *ps){
+    Subscriber *s=ps->head;
+    while (s){ Subscriber *nx=s->next; free(s); s=nx; }
+    ps->head=NULL; ps->count=0;
+}
+
+/* ====== CDC (mutation stream over a Unix socket) ====== */
+static long long now_ms(void){
+    struct timespec ts; timespec_get(&ts, TIME_UTC);
+    return (long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+void cdc_init(Cdc *c){
+    memset(c,0,sizeof *c);
+    c->listen_fd = -1;
+    c->repl_fd = -1;
+}
+static int cdc_active(const Cdc *c){ return c->listen_fd >= 0 || c->repl_fd >= 0; }
+
+/* Encoder scratch: one record is built here, then copied to every subscriber. */
+typedef struct CdcRec { unsigned char b[16 + 4*(2+CONTENT_MAX)]; int n; } CdcRec;
+
+static void put_u(CdcRec *r, unsigned long long v, int bytes){
+    for (int i=0;i<bytes;i++) r->b[r->n++] = (unsigned char)(v >> (8*i));
+}
+static void put_str(CdcRec *r, const char *s){
+    size_t n = strlen(s);
+    put_u(r, n, 2); memcpy(r->b + r->n, s, n); r->n += (int)n;
+}
+static void rec_begin(Cdc *c, CdcRec *r, int type){
+    r->n = 4;
+    put_u(r, (unsigned)type, 1);
+    put_u(r, c->syncing ? c->seq : ++c->seq, 8);
+    put_u(r, (unsigned long long)now_ms(), 8);
+}
+static int buf_append(unsigned char **buf, size_t *len, size_t *cap, const unsigned char *b, int n){
+    if (*len + (size_t)n > *cap){
+        size_t nc = *cap ? *cap*2 : 65536;
+        while (nc < *len + (size_t)n) nc *= 2;
+        unsigned char *tmp = (unsigned char*)realloc(*buf, nc);
+        if (!tmp) return 0;
+        *buf = tmp; *cap = nc;
+    }
+    memcpy(*buf + *len, b, (size_t)n); *len += (size_t)n;
+    return 1;
+}
+static int wal_append(Cdc *c, const unsigned char *b, int n){ return buf_append(&c->wal, &c->wal_len, &c->wal_cap, b, n); }
+
+#ifdef _WIN32
+int  cdc_open(Cdc *c, const char *path){ (void)c; (void)path; return 0; }
+int  repl_listen(Cdc *c, const char *path){ (void)c; (void)path; return 0; }
+static void rec_send(Cdc *c, CdcRec *r, int to_wal, int to_subs){ (void)c; (void)r; (void)to_wal; (void)to_subs; (void)wal_append; }
+static void rec_commit(Cdc *c, CdcRec *r){ (void)c; (void)r; }
+void cdc_flush(Cdc *c){ (void)c; }
+void cdc_close(Cdc *c){ (void)c; }
+int  replica_connect(App *app, const char *path){ (void)app; (void)path; return 0; }
+int  replica_poll(App *app){ (void)app; return 0; }
+void replica_close(Replica *r){ r->fd = -1; }
+#else
+static int unix_listen(const char *path){
+    struct sockaddr_un sa;
+    if (strlen(path) >= sizeof sa.sun_path) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    memset(&sa,0,sizeof sa); sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    unlink(path);
+    if (bind(fd,(struct sockaddr*)&sa,sizeof sa)!=0 || listen(fd,CDC_MAX_SUBSCRIBERS)!=0){
+        close(fd); return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd,F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+static int unix_connect(const char *path){
+    struct sockaddr_un sa;
+    if (strlen(path) >= sizeof sa.sun_path) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    memset(&sa,0,sizeof sa); sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+    if (connect(fd,(struct sockaddr*)&sa,sizeof sa)!=0){ close(fd); return -1; }
+    return fd;
+}
+/* Non-blocking send of buf[0..len); returns bytes written or -1 if the peer is gone. */
+static int send_some(int fd, const unsigned char *buf, size_t len){
+    size_t off = 0;
+    while (off < len){
+#ifdef MSG_NOSIGNAL
+        ssize_t w = send(fd, buf+off, len-off, MSG_NOSIGNAL);
+#else
+        ssize_t w = send(fd, buf+off, len-off, 0);
+#endif
+        if (w > 0){ off += (size_t)w; continue; }
+        if (w < 0 && (errno==EAGAIN || errno==EWOULDBLOCK)) break;
+        return -1;
+    }
+    return (int)off;
+}
+
+int cdc_open(Cdc *c, const char *path){
+    int fd = unix_listen(path);
+    if (fd < 0) return 0;
+    c->listen_fd = fd;
+    strncpy(c->path, path, CDC_PATH_MAX-1);
+    return 1;
+}
+int repl_listen(Cdc *c, const char *path){
+    int fd = unix_listen(path);
+    if (fd < 0) return 0;
+    c->repl_fd = fd;
+    strncpy(c->repl_path, path, CDC_PATH_MAX-1);
+    return 1;
+}
+static void repl_drop(Cdc *c, int i){
+    close(c->followers[i].fd); free(c->followers[i].sync);
+    c->followers[i] = c->followers[--c->nfollowers];
+}
+static void cdc_drop(Cdc *c, int i){
+    close(c->subs[i].fd); free(c->subs[i].buf);
+    c->subs[i] = c->subs[--c->nsubs];
+}
+/* Append the finished record to the replication log and/or every
+ * subscriber buffer. A subscriber that would exceed CDC_BUF_MAX is
+ * disconnected instead of seeing a gap. */
+static void rec_send(Cdc *c, CdcRec *r, int to_wal, int to_subs){
+    unsigned body = (unsigned)(r->n - 4);
+    for (int i=0;i<4;i++) r->b[i] = (unsigned char)(body >> (8*i));
+    if (c->syncing){
+        ReplFollower *f = c->syncing;
+        if (to_wal) buf_append(&f->sync, &f->sync_len, &f->sync_cap, r->b, r->n);
+        return;
+    }
+    if (to_wal && c->repl_fd >= 0) wal_append(c, r->b, r->n);
+    if (!to_subs) return;
+    c->records++;
+    for (int i=0;i<c->nsubs;){
+        CdcSub *s = &c->subs[i];
+        if (s->len + r->n > CDC_BUF_MAX){ c->cut_off++; cdc_drop(c,i); continue; }
+        memcpy(s->buf + s->len, r->b, r->n); s->len += r->n;
+        i++;
+    }
+}
+static void rec_commit(Cdc *c, CdcRec *r){ rec_send(c, r, 1, 1); }
+/* Called once per main-loop turn: accept new subscribers and followers and
+ * write out everything pending since the last turn without blocking. */
+void cdc_flush(Cdc *c){
+    TRACE_SPAN("cdc_flush");
+    int fd;
+    if (c->listen_fd >= 0){
+        while (c->nsubs < CDC_MAX_SUBSCRIBERS && (fd = accept(c->listen_fd,NULL,NULL)) >= 0){
+            fcntl(fd, F_SETFL, fcntl(fd,F_GETFL) | O_NONBLOCK);
+            unsigned char *b = (unsigned char*)malloc(CDC_BUF_MAX);
+            if (!b){ close(fd); break; }
+            c->subs[c->nsubs].fd = fd; c->subs[c->nsubs].buf = b; c->subs[c->nsubs].len = 0;
+            c->nsubs++;
+        }
+        for (int i=0;i<c->nsubs;){
+            CdcSub *s = &c->subs[i];
+            int off = send_some(s->fd, s->buf, (size_t)s->len);
+            if (off < 0){ cdc_drop(c,i); continue; }
+            c->bytes_sent += (unsigned long)off;
+            memmove(s->buf, s->buf+off, (size_t)(s->len-off)); s->len -= off;
+            i++;
+        }
+    }
+    if (c->repl_fd >= 0){
+        while (c->nfollowers < REPL_MAX_FOLLOWERS && (fd = accept(c->repl_fd,NULL,NULL)) >= 0){
+            fcntl(fd, F_SETFL, fcntl(fd,F_GETFL) | O_NONBLOCK);
+            ReplFollower *f = &c->followers[c->nfollowers++];
+            memset(f, 0, sizeof *f);
+            f->fd = fd; f->off = c->wal_base + c->wal_len;
+            if (c->snapshot){ c->syncing = f; c->snapshot(c->snapshot_ctx); c->syncing = NULL; }
+        }
+        unsigned long long end = c->wal_base + c->wal_len, low = end;
+        for (int i=0;i<c->nfollowers;){
+            ReplFollower *f = &c->followers[i];
+            int w = 0;
+            if (f->sync_off < f->sync_len){
+                w = send_some(f->fd, f->sync + f->sync_off, f->sync_len - f->sync_off);
+                if (w > 0 && (f->sync_off += (size_t)w) == f->sync_len){
+                    free(f->sync); f->sync = NULL; f->sync_len = f->sync_off = f->sync_cap = 0;
+                }
+            }
+            if (w >= 0 && !f->sync){
+                w = send_some(f->fd, c->wal + (f->off - c->wal_base), (size_t)(end - f->off));
+                if (w > 0) f->off += (unsigned long long)w;
+            }
+            if (w < 0 || end - f->off > REPL_WAL_MAX){
+                if (w >= 0) c->repl_dropped++;
+                repl_drop(c, i); continue;
+            }
+            if (f->off < low) low = f->off;
+            i++;
+        }
+        /* everything every follower has been sent can go */
+        size_t done = (size_t)(low - c->wal_base);
+        if (done){
+            memmove(c->wal, c->wal + done, c->wal_len - done);
+            c->wal_len -= done; c->wal_base = low;
+            if (c->wal_cap > 65536 && c->wal_len < c->wal_cap/4){
+                unsigned char *t = (unsigned char*)realloc(c->wal, c->wal_cap/2);
+                if (t){ c->wal = t; c->wal_cap /= 2; }
+            }
+        }
+    }
+}
+void cdc_close(Cdc *c){
+    if (!cdc_active(c)) return;
+    cdc_flush(c);
+    while (c->nsubs) cdc_drop(c, 0);
+    while (c->nfollowers) repl_drop(c, 0);
+    if (c->listen_fd >= 0){ close(c->listen_fd); unlink(c->path); }
+    if (c->repl_fd >= 0){ close(c->repl_fd); unlink(c->repl_path); }
+    free(c->wal); c->wal = NULL; c->wal_len = c->wal_cap = 0; c->wal_base = 0;
+    c->listen_fd = c->repl_fd = -1;
+}
+
+int replica_connect(App *app, const char *path){
+    int fd = unix_connect(path);
+    if (fd < 0) return 0;
+    fcntl(fd, F_SETFL, fcntl(fd,F_GETFL) | O_NONBLOCK);
+    app->replica.fd = fd;
+    app->read_only = 1;
+    return 1;
+}
+/* Drain whatever the leader has sent and apply every complete record.
+ * Returns the number of records applied. */
+int replica_poll(App *app){
+    Replica *r = &app->replica;
+    int applied = 0;
+    while (r->fd >= 0){
+        ssize_t n = read(r->fd, r->buf + r->len, (size_t)(REPL_BUF - r->len));
+        if (n == 0 || (n < 0 && errno!=EAGAIN && errno!=EWOULDBLOCK)){ replica_close(r); break; }
+        if (n > 0) r->len += (int)n;
+        int off = 0, used;
+        CdcEvent ev;
+        while ((used = cdc_decode(r->buf+off, r->len-off, &ev)) > 0){
+            app_apply(app, &ev);
+            r->applied_seq = ev.seq; r->applied++; applied++;
+            r->lag_ms = now_ms() - ev.time_ms;
+            off += used;
+        }
+        if (used < 0){ replica_close(r); break; }  /* corrupt stream */
+        memmove(r->buf, r->buf+off, (size_t)(r->len-off)); r->len -= off;
+        if (n < 0) break;
+    }
+    return applied;
+}
+void replica_close(Replica *r){
+    if (r->fd >= 0) close(r->fd);
+    r->fd = -1;
+}
+#endif
+
+void cdc_follow(Cdc *c, int type, const char *from, const char *to, unsigned when){
+    if (!cdc_active(c)) return;
+    CdcRec r; rec_begin(c,&r,type);
+    put_str(&r,from); put_str(&r,to); put_u(&r,when,4);
+    rec_commit(c,&r);
+}
+/* The password only goes to the replication log, which followers need to
+ * rebuild logins; analytics subscribers get the same record (same seq)
+ * with an empty password. */
+void cdc_register(Cdc *c, const char *user, const char *password){
+    if (!cdc_active(c)) return;
+    CdcRec r; rec_begin(c,&r,CDC_REGISTER);
+    put_str(&r,user);
+    int at = r.n;
+    put_str(&r,"");
+    rec_send(c,&r,0,1);
+    r.n = at; put_str(&r,password);
+    rec_send(c,&r,1,0);
+}
+void cdc_post(Cdc *c, const Post *p){
+    if (!cdc_active(c)) return;
+    CdcRec r; rec_begin(c,&r,CDC_POST);
+    put_u(&r,(unsigned)p->id,4);
+    put_str(&r,p->author); put_str(&r,p->timestamp); put_str(&r,p->content);
+    rec_commit(c,&r);
+}
+static void cdc_msg(Cdc *c, int type, const Message *m, int to_wal){
+    if (!cdc_active(c)) return;
+    CdcRec r; rec_begin(c,&r,type);
+    put_str(&r,m->from); put_str(&r,m->to); put_str(&r,m->timestamp); put_str(&r,m->content);
+    rec_send(c,&r,to_wal,1);
+}
+void cdc_message(Cdc *c, int type, const Message *m){ cdc_msg(c, type, m, 1); }
+/* A message handed to the delivery worker: subscribers see it, but it
+ * stays out of the replication log, since the worker delivers it and a
+ * replica would queue it with no DELIVER ever following. */
+void cdc_message_handoff(Cdc *c, const Message *m){ cdc_msg(c, CDC_MESSAGE, m, 0); }
+
+/* ---- decoding ---- */
+static unsigned long long get_u(const unsigned char *p, int bytes){
+    unsigned long long v=0;
+    for (int i=0;i<bytes;i++) v |= (unsigned long long)p[i] << (8*i);
+    return v;
+}
+static int get_str(const unsigned char **p, const unsigned char *end, char *dst, int cap){
+    if (end - *p < 2) return 0;
+    int n = (int)get_u(*p,2); *p += 2;
+    if (end - *p < n) return 0;
+    int k = n < cap-1 ? n : cap-1;
+    memcpy(dst,*p,(size_t)k); dst[k]='\0';
+    *p += n; return 1;
+}
+/* Decode one record from buf. Returns bytes consumed, 0 if the record is
+ * not complete yet, -1 if it is malformed. */
+int cdc_decode(const unsigned char *buf, int len, CdcEvent *ev){
+    if (len < 4) return 0;
+    int body = (int)get_u(buf,4);
+    if (body < 17 || body > (int)sizeof(((CdcRec*)0)->b)) return -1;
+    if (len < 4 + body) return 0;
+    const unsigned char *p = buf+4, *end = buf+4+body;
+    memset(ev,0,sizeof *ev);
+    ev->type = p[0];
+    ev->seq = get_u(p+1,8);
+    ev->time_ms = (long long)get_u(p+9,8);
+    p += 17;
+    int ok;
+    switch (ev->type){
+        case CDC_REGISTER:
+            ok = get_str(&p,end,ev->a,USERNAME_MAX) && get_str(&p,end,ev->b,USERNAME_MAX);
+            break;
+        case CDC_FOLLOW: case CDC_UNFOLLOW:
+            ok = get_str(&p,end,ev->a,USERNAME_MAX) && get_str(&p,end,ev->b,USERNAME_MAX) && end-p >= 4;
+            if (ok){ ev->follow_time = (unsigned)get_u(p,4); p += 4; }
+            break;
+        case CDC_POST:
+            ok = end-p >= 4;
+            if (ok){ ev->post_id = (int)get_u(p,4); p += 4; }
+            ok = ok && get_str(&p,end,ev->a,USERNAME_MAX) && get_str(&p,end,ev->timestamp,TIMESTAMP_MAX)
+                    && get_str(&p,end,ev->content,CONTENT_MAX);
+            break;
+        case CDC_MESSAGE: case CDC_DELIVER:
+            ok = get_str(&p,end,ev->a,USERNAME_MAX) && get_str(&p,end,ev->b,USERNAME_MAX)
+              && get_str(&p,end,ev->timestamp,TIMESTAMP_MAX) && get_str(&p,end,ev->content,CONTENT_MAX);
+            break;
+        default: ok = 0;
+    }
+    return ok ? 4 + body : -1;
+}
+
+/* ====== Shared-memory message ring (front-end -> delivery worker) ====== */
+#ifdef _WIN32
+int      shmring_create(ShmRing *r, const char *name, unsigned cap){ (void)r; (void)name; (void)cap; return 0; }
+int      shmring_attach(ShmRing *r, const char *name){ (void)r; (void)name; return 0; }
+Message* shmring_reserve(ShmRing *r, unsigned long long *ticket){ (void)r; (void)ticket; return NULL; }
+void     shmring_commit(ShmRing *r, unsigned long long ticket){ (void)r; (void)ticket; }
+int      shmring_push(ShmRing *r, const Message *m){ (void)r; (void)m; return 0; }
+const Message* shmring_peek(ShmRing *r){ (void)r; return NULL; }
+void     shmring_release(ShmRing *r){ (void)r; }
+int      shmring_wait(ShmRing *r, int timeout_ms){ (void)r; (void)timeout_ms; return 0; }
+void     shmring_close(ShmRing *r){ (void)r; }
+int      delivery_worker_run(const char *name){ (void)name; return 0; }
+#else
+static int shm_map(ShmRing *r, const char *name, int fd, size_t size){
+    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return 0;
+    r->hdr = (ShmRingHdr*)p; r->size = size;
+    strncpy(r->name, name, sizeof r->name - 1); r->name[sizeof r->name - 1]='\0';
+    return 1;
+}
+/* name is a POSIX shm name such as "/smm-delivery". */
+int shmring_create(ShmRing *r, const char *name, unsigned cap){
+    if (cap == 0 || (cap & (cap-1))) return 0;
+    size_t size = sizeof(ShmRingHdr) + sizeof(ShmSlot)*cap;
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT|O_EXCL|O_RDWR, 0600);
+    if (fd < 0) return 0;
+    if (ftruncate(fd, (off_t)size) != 0){ close(fd); shm_unlink(name); return 0; }
+    if (!shm_map(r, name, fd, size)){ shm_unlink(name); return 0; }
+    ShmRingHdr *h = r->hdr;
+    h->cap = cap;
+    atomic_init(&h->head, 0); atomic_init(&h->tail, 0);
+    atomic_init(&h->futex, 0); atomic_init(&h->sleepers, 0);
+    for (unsigned i=0;i<cap;i++) atomic_init(&h->slots[i].seq, i);
+    atomic_thread_fence(memory_order_release);
+    h->magic = SHM_RING_MAGIC;
+    r->owner = 1;
+    return 1;
+}
+int shmring_attach(ShmRing *r, const char *name){
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd,&st) != 0 || (size_t)st.st_size < sizeof(ShmRingHdr)){ close(fd); return 0; }
+    if (!shm_map(r, name, fd, (size_t)st.st_size)) return 0;
+    if (r->hdr->magic != SHM_RING_MAGIC
+     || r->size < sizeof(ShmRingHdr) + sizeof(ShmSlot)*r->hdr->cap){ munmap(r->hdr, r->size); r->hdr=NULL; return 0; }
+    r->owner = 0;
+    return 1;
+}
+
+static void futex_wake(_Atomic unsigned *addr){
+#ifdef __linux__
+    syscall(SYS_futex, (unsigned*)addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+    (void)addr;
+#endif
+}
+static void futex_wait(_Atomic unsigned *addr, unsigned val, int timeout_ms){
+#ifdef __linux__
+    struct timespec ts = { timeout_ms/1000, (long)(timeout_ms%1000)*1000000L };
+    syscall(SYS_futex, (unsigned*)addr, FUTEX_WAIT, val, timeout_ms >= 0 ? &ts : NULL, NULL, 0);
+#else
+    (void)addr; (void)val;
+    struct timespec ts = { 0, 1000000L };   /* no futex: poll every ms */
+    (void)timeout_ms; nanosleep(&ts, NULL);
+#endif
+}
+
+/* Claim the next free slot; the caller fills the Message in shared memory
+ * and then calls shmring_commit. Returns NULL when the ring is full. */
+Message* shmring_reserve(ShmRing *r, unsigned long long *ticket){
+    ShmRingHdr *h = r->hdr;
+    unsigned long long pos = atomic_load_explicit(&h->tail, memory_order_relaxed);
+    for (;;){
+        ShmSlot *s = &h->slots[pos & (h->cap-1)];
+        unsigned long long seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        long long dif = (long long)(seq - pos);
+        if (dif == 0){
+            if (atomic_compare_exchange_weak_explicit(&h->tail, &pos, pos+1,
+                    memory_order_relaxed, memory_order_relaxed)){
+                *ticket = pos; return &s->msg;
+            }
+        } else if (dif < 0) return NULL;
+        else pos = atomic_load_explicit(&h->tail, memory_order_relaxed);
+    }
+}
+void shmring_commit(ShmRing *r, unsigned long long ticket){
+    ShmRingHdr *h = r->hdr;
+    atomic_store_explicit(&h->slots[ticket & (h->cap-1)].seq, ticket+1, memory_order_release);
+    atomic_fetch_add_explicit(&h->futex, 1, memory_order_release);
+    if (atomic_load_explicit(&h->sleepers, memory_order_acquire)) futex_wake(&h->futex);
+}
+int shmring_push(ShmRing *r, const Message *m){
+    unsigned long long t;
+    Message *slot = shmring_reserve(r, &t);
+    if (!slot) return 0;
+    *slot = *m;
+    shmring_commit(r, t);
+    return 1;
+}
+/* Single consumer: the oldest published message, read in place, or NULL. */
+const Message* shmring_peek(ShmRing *r){
+    ShmRingHdr *h = r->hdr;
+    unsigned long long pos = atomic_load_explicit(&h->head, memory_order_relaxed);
+    ShmSlot *s = &h->slots[pos & (h->cap-1)];
+    if (atomic_load_explicit(&s->seq, memory_order_acquire) != pos+1) return NULL;
+    return &s->msg;
+}
+void shmring_release(ShmRing *r){
+    ShmRingHdr *h = r->hdr;
+    unsigned long long pos = atomic_load_explicit(&h->head, memory_order_relaxed);
+    atomic_store_explicit(&h->slots[pos & (h->cap-1)].seq, pos + h->cap, memory_order_release);
+    atomic_store_explicit(&h->head, pos+1, memory_order_relaxed);
+}
+/* Sleep until something is published or timeout_ms passes (-1 = forever).
+ * Returns 1 if a message is ready. */
+int shmring_wait(ShmRing *r, int timeout_ms){
+    ShmRingHdr *h = r->hdr;
+    if (shmring_peek(r)) return 1;
+    atomic_fetch_add_explicit(&h->sleepers, 1, memory_order_acq_rel);
+    unsigned v = atomic_load_explicit(&h->futex, memory_order_acquire);
+    if (!shmring_peek(r)) futex_wait(&h->futex, v, timeout_ms);
+    atomic_fetch_sub_explicit(&h->sleepers, 1, memory_order_acq_rel);
+    return shmring_peek(r) != NULL;
+}
+void shmring_close(ShmRing *r){
+    if (!r->hdr) return;
+    munmap(r->hdr, r->size); r->hdr = NULL;
+    if (r->owner) shm_unlink(r->name);
+}
+
+static volatile sig_atomic_t worker_stop;
+static void worker_on_signal(int sig){ (void)sig; worker_stop = 1; }
+
+/* Delivery worker process: owns the ring and delivers messages as the
+ * front-end publishes them, until SIGINT/SIGTERM. */
+int delivery_worker_run(const char *name){
+    ShmRing r;
+    if (!shmring_create(&r, name, SHM_RING_CAP)) return 0;
+    signal(SIGINT, worker_on_signal); signal(SIGTERM, worker_on_signal);
+    printf("Delivery worker on %s\n", name); fflush(stdout);
+    while (!worker_stop){
+        if (!shmring_wait(&r, 500)) continue;
+        const Message *m;
+        while ((m = shmring_peek(&r)) != NULL){
+            printf("Delivered: %s -> %s | %s\n", m->from, m->to, m->content);
+            shmring_release(&r);
+        }
+        fflush(stdout);
+    }
+    shmring_close(&r);
+    return 1;
+}
+#endif
+
+/* ====== State handoff (restart without reloading) ====== */
+#ifdef _WIN32
+int app_handoff_save(App *app, const char *name){ (void)app; (void)name; return 0; }
+int app_handoff_attach(App *app, const char *name){ (void)app; (void)name; return 0; }
+#else
+static int bst_count(const UserNode *n){ return n ? 1 + bst_count(n->left) + bst_count(n->right) : 0; }
+static User* bst_preorder(const UserTable *t, const UserNode *n, User *out){
+    if (!n) return out;
+    users_get(t, n->id, out++);
+    out = bst_preorder(t, n->left, out);
+    return bst_preorder(t, n->right, out);
+}
+static int adj_dump_name(void *ctx, const char *name){
+    char **out = (char**)ctx;
+    memcpy(*out, name, USERNAME_MAX); *out += USERNAME_MAX;
+    return 1;
+}
+
+/* Write the whole App into shared memory object `name` for the next process. */
+int app_handoff_save(App *app, const char *name){
+    TRACE_SPAN("app_handoff_save");
+    /* With a post store the memtable goes to disk now, so the image and
+     * app_free's flush never both carry the same posts. */
+    if (app->lsm && !lsm_flush(app->lsm, &app->posts))
+        fputs("Warning: post store flush failed.\n", stderr);
+    int nusers = bst_count(app->users_bst), nv = app->graph.user_count, nadj = 0, nlog = 0;
+    for (GraphUser *gu=app->graph.head; gu; gu=gu->next){
+        nadj += gu->following.count + gu->followers.count;
+        nlog += gu->follow_log.n;
+    }
+    size_t users_off = sizeof(HandoffHdr);
+    size_t vertices_off = users_off + sizeof(User)*(size_t)nusers;
+    size_t names_off = vertices_off + sizeof(HandoffVertex)*(size_t)nv;
+    size_t log_off = names_off + (size_t)USERNAME_MAX*(size_t)nadj;
+    size_t posts_off = log_off + sizeof(HandoffFollow)*(size_t)nlog;
+    size_t msgs_off = posts_off + sizeof(Post)*(size_t)app->posts.size;
+    size_t size = msgs_off + sizeof(Message)*(size_t)app->mq.count;
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT|O_EXCL|O_RDWR, 0600);
+    if (fd < 0) return 0;
+    if (ftruncate(fd, (off_t)size) != 0){ close(fd); shm_unlink(name); return 0; }
+    char *base = (char*)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED){ shm_unlink(name); return 0; }
+
+    HandoffHdr *h = (HandoffHdr*)base;
+    memset(h, 0, sizeof *h);
+    h->version = HANDOFF_VERSION; h->size = size;
+    h->nusers = nusers; h->nvertices = nv; h->nposts = app->posts.size; h->nmsgs = app->mq.count;
+    h->users_off = users_off; h->vertices_off = vertices_off;
+    h->posts_off = posts_off; h->msgs_off = msgs_off;
+    h->admin = app->admin;
+    h->max_users = app->max_users; h->max_posts = app->max_posts; h->max_messages = app->max_messages;
+
+    bst_preorder(&app->users, app->users_bst, (User*)(base + users_off));
+    HandoffVertex *v = (HandoffVertex*)(base + vertices_off);
+    char *names = base + names_off;
+    HandoffFollow *lg = (HandoffFollow*)(base + log_off);
+    for (GraphUser *gu=app->graph.head; gu; gu=gu->next, v++){
+        memcpy(v->username, gu->username, USERNAME_MAX);
+        v->nlog = gu->follow_log.n;
+        v->log_off = (unsigned long long)((char*)lg - base);
+        for (int i=0;i<gu->follow_log.n;i++, lg++){
+            const FollowEvent *e = &gu->follow_log.ev[i];
+            lg->t = e->t; lg->follow = e->who >= 0;
+            memcpy(lg->name, graph_name(&app->graph, e->who >= 0 ? e->who : ~e->who), USERNAME_MAX);
+        }
+        v->nfollowing = gu->following.count;
+        v->nfollowers = gu->followers.count;
+        v->following_off = (unsigned long long)(names - base);
+        graph_foreach(&app->graph, gu, GRAPH_FOLLOWING, adj_dump_name, &names);
+        v->followers_off = (unsigned long long)(names - base);
+        graph_foreach(&app->graph, gu, GRAPH_FOLLOWERS, adj_dump_name, &names);
+    }
+    if (app->posts.size) memcpy(base + posts_off, app->posts.data, sizeof(Post)*(size_t)app->posts.size);
+    Message *m = (Message*)(base + msgs_off);
+    for (int i=0, idx=app->mq.head; i<app->mq.count; ++i, idx=(idx+1)%MAX_MESSAGES) *m++ = app->mq.buf[idx];
+
+    atomic_thread_fence(memory_order_release);
+    h->magic = HANDOFF_MAGIC;               /* image is complete */
+    munmap(base, size);
+    return 1;
+}
+
+/* The image may be stale or from another build: every section has to lie
+ * inside the mapping and every string has to be terminated in its field
+ * before anything is read through it. */
+static int span_ok(size_t size, unsigned long long off, int count, size_t elem){
+    return count >= 0 && off <= size && (unsigned long long)count <= (size - off) / elem;
+}
+static int str_ok(const char *s, size_t cap){ return memchr(s, '\0', cap) != NULL; }
+static int handoff_valid(const char *base, size_t size){
+    const HandoffHdr *h = (const HandoffHdr*)base;
+    if (!span_ok(size, h->users_off, h->nusers, sizeof(User))
+     || !span_ok(size, h->vertices_off, h->nvertices, sizeof(HandoffVertex))
+     || !span_ok(size, h->posts_off, h->nposts, sizeof(Post))
+     || !span_ok(size, h->msgs_off, h->nmsgs, sizeof(Message))) return 0;
+    if (h->users_off % _Alignof(User) || h->vertices_off % _Alignof(HandoffVertex)
+     || h->posts_off % _Alignof(Post) || h->msgs_off % _Alignof(Message)) return 0;
+    const User *u = (const User*)(base + h->users_off);
+    for (int i=0;i<h->nusers;i++)
+        if (!str_ok(u[i].username, USERNAME_MAX) || !str_ok(u[i].password, PASSWORD_MAX)) return 0;
+    const HandoffVertex *v = (const HandoffVertex*)(base + h->vertices_off);
+    for (int i=0;i<h->nvertices;i++){
+        if (!str_ok(v[i].username, USERNAME_MAX)
+         || !span_ok(size, v[i].following_off, v[i].nfollowing, USERNAME_MAX)
+         || !span_ok(size, v[i].followers_off, v[i].nfollowers, USERNAME_MAX)
+         || !span_ok(size, v[i].log_off, v[i].nlog, sizeof(HandoffFollow))
+         || v[i].log_off % _Alignof(HandoffFollow)) return 0;
+        for (int k=0;k<v[i].nfollowing;k++) if (!str_ok(base + v[i].following_off + (size_t)k*USERNAME_MAX, USERNAME_MAX)) return 0;
+        for (int k=0;k<v[i].nfollowers;k++) if (!str_ok(base + v[i].followers_off + (size_t)k*USERNAME_MAX, USERNAME_MAX)) return 0;
+        const HandoffFollow *lg = (const HandoffFollow*)(base + v[i].log_off);
+        for (int k=0;k<v[i].nlog;k++) if (!str_ok(lg[k].name, USERNAME_MAX)) return 0;
+    }
+    const Post *p = (const Post*)(base + h->posts_off);
+    for (int i=0;i<h->nposts;i++)
+        if (!str_ok(p[i].author, USERNAME_MAX) || !str_ok(p[i].timestamp, TIMESTAMP_MAX) || !str_ok(p[i].content, CONTENT_MAX)) return 0;
+    const Message *m = (const Message*)(base + h->msgs_off);
+    for (int i=0;i<h->nmsgs;i++)
+        if (!str_ok(m[i].from, USERNAME_MAX) || !str_ok(m[i].to, USERNAME_MAX)
+         || !str_ok(m[i].timestamp, TIMESTAMP_MAX) || !str_ok(m[i].content, CONTENT_MAX)) return 0;
+    return str_ok(h->admin.username, ADMIN_USERNAME_MAX) && str_ok(h->admin.password, ADMIN_PASSWORD_MAX);
+}
+/* Rebuild the App from a previous process's image and remove the image.
+ * Returns 0 if there is no (valid) image under `name`. Call it after the
+ * CDC/replication sockets are open so the restored state is published. */
+int app_handoff_attach(App *app, const char *name){
+    TRACE_SPAN("app_handoff_attach");
+    int fd = shm_open(name, O_RDONLY, 0600);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd,&st) != 0 || (size_t)st.st_size < sizeof(HandoffHdr)){ close(fd); return 0; }
+    size_t size = (size_t)st.st_size;
+    const char *base = (const char*)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return 0;
+    const HandoffHdr *h = (const HandoffHdr*)base;
+    if (h->magic != HANDOFF_MAGIC || h->version != HANDOFF_VERSION || h->size != size || !handoff_valid(base, size)){
+        munmap((void*)base, size); return 0;
+    }
+
+    const User *u = (const User*)(base + h->users_off);
+    for (int i=0;i<h->nusers;i++){
+        int ok=0; app->users_bst = bst_insert(&app->users, app->users_bst, u[i].username, u[i].password, &ok);
+        if (ok){
+            UserHot *uh = &app->users.hot[app->users.count-1];
+            uh->followers = u[i].followers; uh->following = u[i].following;
+        }
+    }
+    /* graph_add_user and adj lists prepend, so replay each list back to front */
+    const HandoffVertex *v = (const HandoffVertex*)(base + h->vertices_off);
+    for (int i=h->nvertices-1;i>=0;i--) graph_add_user(&app->graph, v[i].username);
+    for (int i=0;i<h->nvertices;i++){
+        const char *fw = base + v[i].following_off, *fr = base + v[i].followers_off;
+        for (int k=v[i].nfollowing-1;k>=0;k--)
+            graph_add_half_edge(&app->graph, v[i].username, fw + (size_t)k*USERNAME_MAX, GRAPH_FOLLOWING);
+        for (int k=v[i].nfollowers-1;k>=0;k--)
+            graph_add_half_edge(&app->graph, v[i].username, fr + (size_t)k*USERNAME_MAX, GRAPH_FOLLOWERS);
+        GraphUser *gu = graph_find(&app->graph, v[i].username);   /* replace the replayed follow times */
+        if (!gu) continue;
+        gu->follow_log.n = 0;
+        const HandoffFollow *lg = (const HandoffFollow*)(base + v[i].log_off);
+        for (int k=0;k<v[i].nlog;k++) graph_log_append(&app->graph, gu, lg[k].name, lg[k].t, lg[k].follow);
+    }
+    const Post *p = (const Post*)(base + h->posts_off);
+    if (h->nposts > app->posts.cap){
+        Post *tmp = (Post*)realloc(app->posts.data, sizeof(Post)*(size_t)h->nposts);
+        if (tmp){ app->posts.data = tmp; app->posts.cap = h->nposts; }
+    }
+    int skip = 0, np;
+    if (app->lsm){                      /* posts already in the store stay there */
+        int top = lsm_max_id(app->lsm);
+        while (skip < h->nposts && p[skip].id <= top) skip++;
+    }
+    np = h->nposts - skip <= app->posts.cap ? h->nposts - skip : app->posts.cap;
+    memcpy(app->posts.data, p + skip, sizeof(Post)*(size_t)np);
+    app->posts.size = np;
+    if (np) next_post_id_reset(p[skip+np-1].id + 1);
+    const Message *m = (const Message*)(base + h->msgs_off);
+    for (int i=0;i<h->nmsgs;i++) mq_enqueue(&app->mq, &m[i]);
+    app->admin = h->admin;
+    app->max_users = h->max_users; app->max_posts = h->max_posts; app->max_messages = h->max_messages;
+
+    munmap((void*)base, size);
+    shm_unlink(name);
+    app_publish_state(app);     /* it never went through the CDC calls */
+    return 1;
+}
+#endif
+
+/* ====== App ====== */
+/* A new post changes the feed of its author and of everyone following them. */
+static int app_invalidate_name(void *ctx, const char *name){ app_feed_invalidate((App*)ctx, name); return 1; }
+static void app_on_post(void *ctx, const Post *p){
+    App *app=(App*)ctx;
+    GraphUser *gu = graph_find(&app->graph, p->author);
+    if (gu){
+        gu->feed_valid = 0;
+        graph_foreach(&app->graph, gu, GRAPH_FOLLOWERS, app_invalidate_name, app);
+    }
+    pubsub_publish(&app->subs, &app->graph, p);
+    cdc_post(&app->cdc, p);
+    if (app->lsm && app->posts.size >= app->lsm->memtable_max && !lsm_flush(app->lsm, &app->posts))
+        fputs("Warning: post store flush failed.\n", stderr);
+}
+
+/* Emit the whole current state as ordinary records: a new replication
+ * follower's snapshot, and the state a handoff restored. */
+typedef struct PubFollow { unsigned t; const char *from, *to; } PubFollow;
+typedef struct PubFollows { PubFollow *v; int n, cap; const char *to; } PubFollows;
+static int collect_follow(void *ctx, const char *name, unsigned t){
+    PubFollows *p = (PubFollows*)ctx;
+    if (p->n == p->cap){
+        int nc = p->cap ? p->cap*2 : 256;
+        PubFollow *nv = (PubFollow*)realloc(p->v, sizeof *nv * (size_t)nc);
+        if (!nv) return 0;
+        p->v = nv; p->cap = nc;
+    }
+    p->v[p->n].t = t; p->v[p->n].from = name; p->v[p->n].to = p->to; p->n++;
+    return 1;
+}
+static int pub_follow_cmp(const void *a, const void *b){
+    unsigned x = ((const PubFollow*)a)->t, y = ((const PubFollow*)b)->t;
+    return (x > y) - (x < y);
+}
+void app_publish_state(App *app){
+    Cdc *c = &app->cdc;
+    if (!cdc_active(c)) return;
+    for (int i=0;i<app->users.count;i++) cdc_register(c, app->users.cold[i].username, app->users.cold[i].password);
+    /* every edge with its follow time, oldest first, so the follower's
+     * follow logs come out in the same order */
+    PubFollows pf = { NULL, 0, 0, NULL };
+    for (GraphUser *gu=app->graph.head; gu; gu=gu->next){
+        pf.to = gu->username;
+        graph_followers_since(&app->graph, gu, 0, collect_follow, &pf);
+    }
+    qsort(pf.v, (size_t)pf.n, sizeof *pf.v, pub_follow_cmp);
+    for (int i=0;i<pf.n;i++) cdc_follow(c, CDC_FOLLOW, pf.v[i].from, pf.v[i].to, pf.v[i].t);
+    free(pf.v);
+    /* posts oldest first, disk runs included */
+    Post *all = NULL; int n = 0, cap = 0, below = INT_MAX, k;
+    do {
+        if (n + 64 > cap){ cap = cap ? cap*2 : 256; Post *t = (Post*)realloc(all, sizeof *t * (size_t)cap); if (!t) break; all = t; }
+        k = app_posts_before(app, below, all + n, 64);
+        if (k) below = all[n+k-1].id;
+        n += k;
+    } while (k == 64);
+    while (n--) cdc_post(c, &all[n]);
+    free(all);
+    for (int i=0, idx=app->mq.head; i<app->mq.count; ++i, idx=(idx+1)%MAX_MESSAGES)
+        cdc_message(c, CDC_MESSAGE, &app->mq.buf[idx]);
+}
+static void app_cdc_snapshot(void *ctx){ app_publish_state((App*)ctx); }
+
+void app_init(App *app){
+    users_init(&app->users);
+    app->users_bst=NULL; app->current=NULL;
+    posts_init(&app->posts, 8);
+    app->posts.on_add = app_on_post; app->posts.on_add_ctx = app;
+    mq_init(&app->mq);
+    graph_init(&app->graph);
+    pubsub_init(&app->subs);
+    cdc_init(&app->cdc);
+    app->cdc.snapshot = app_cdc_snapshot; app->cdc.snapshot_ctx = app;
+    memset(&app->replica, 0, sizeof app->replica);
+    app->replica.fd = -1;
+    app->read_only = 0;
+    app->delivery = NULL;
+    app->ustore = NULL;
+    app->lsm = NULL;
+    app->feed_hits = app->feed_misses = app->feed_warmed = 0;
+    app->txn_commits = app->txn_aborts = 0;
+    memset(&app->mvcc, 0, sizeof app->mvcc);
+    app->export = NULL;
+    app->warm = NULL; app->nwarm = 0; app->warm_edges = 0;
+    app->admin.is_registered = 0;
+    app->current_admin = NULL;
+    app->max_users = MAX_USERS;
+    app->max_posts = MAX_POSTS;
+    app->max_messages = MAX_MESSAGES;
+}
+/* Look a user up in memory, faulting the record in from the disk store
+ * (and adding its graph vertex) the first time it is needed. */
+UserNode* app_user_find(App *app, const char *username){
+    UserNode *n = bst_find(&app->users, app->users_bst, username);
+    if (n || !app->ustore) return n;
+    User u;
+    if (!ustore_find(app->ustore, username, &u)) return NULL;
+    int ok=0; app->users_bst = bst_insert(&app->users, app->users_bst, u.username, u.password, &ok);
+    if (!ok || !(n = bst_find(&app->users, app->users_bst, username))) return NULL;
+    user_hot(&app->users, n)->followers = u.followers;
+    user_hot(&app->users, n)->following = u.following;
+    graph_add_user(&app->graph, u.username);
+    return n;
+}
+void app_feed_invalidate(App *app, const char *username){
+    GraphUser *gu = graph_find(&app->graph, username);
+    if (gu) gu->feed_valid = 0;
+}
+
+typedef struct FeedCtx { const Graph *g; GraphUser *gu; StrBuf *out; int n; } FeedCtx;
+static int feed_render_post(void *ctx, const Post *p){
+    FeedCtx *f = (FeedCtx*)ctx;
+    if (strcmp(p->author, f->gu->username)!=0 && !graph_has(f->g, f->gu, GRAPH_FOLLOWING, p->author)) return 1;
+    sb_printf(f->out, " #%d by %s at %s: %s\n", p->id, p->author, p->timestamp, p->content);
+    return ++f->n < FEED_PAGE_POSTS;
+}
+void app_feed_render(App *app, GraphUser *gu){
+    gu->feed.len = 0;
+    FeedCtx f = { &app->graph, gu, &gu->feed, 0 };
+    if (app->lsm) lsm_foreach_desc(app->lsm, &app->posts, feed_render_post, &f);
+    else for (int i=app->posts.size-1; i>=0 && feed_render_post(&f,&app->posts.data[i]); --i);
+    if (!f.n) sb_printf(&gu->feed, " (nothing yet - follow someone or post)\n");
+    gu->feed_valid = 1;
+}
+/* Order local users for feed precompute: highest k-core first, since a
+ * user deep in the dense core is invalidated by, and read alongside, many
+ * others. Returns the largest coreness, or -1 on failure. */
+int app_rank_feeds(App *app){
+    Csr c, sym;
+    if (!csr_build(&c, &app->graph)) return -1;
+    int ok = csr_symmetric(&c, &sym);
+    csr_free(&c);
+    if (!ok) return -1;
+    int *core = (int*)malloc(sizeof(int)*(size_t)(sym.n ? sym.n : 1));
+    GraphUser **warm = (GraphUser**)malloc(sizeof *warm * (size_t)(app->graph.user_count ? app->graph.user_count : 1));
+    int top = core && warm ? csr_kcore(&sym, core) : -1;
+    if (top < 0){ free(core); free(warm); csr_free(&sym); return -1; }
+    int n = 0;
+    for (int k=top; k>0; k--)                   /* vertex = name id in an unpermuted snapshot */
+        for (GraphUser *gu=app->graph.head; gu; gu=gu->next)
+            if (core[gu->id] == k) warm[n++] = gu;
+    free(app->warm);
+    app->warm = warm; app->nwarm = n; app->warm_edges = 0;
+    free(core); csr_free(&sym);
+    return top;
+}
+/* Re-render up to budget stale feeds, in app_rank_feeds order. The order
+ * is rebuilt once enough follows have changed to move users between cores
+ * (or into the ranking at all, e.g. after startup on an empty graph). */
+int app_feed_warm(App *app, int budget){
+    int done = 0;
+    if (app->warm_edges >= FEED_RERANK_EDGES && app_rank_feeds(app) < 0) app->warm_edges = 0;
+    for (int i=0; i<app->nwarm && done<budget; i++)
+        if (!app->warm[i]->feed_valid){ app_feed_render(app, app->warm[i]); done++; }
+    app->feed_warmed += (unsigned long)done;
+    return done;
+}
+
+/* Memtable first, then the on-disk runs. */
+int app_post_find(App *app, int id, Post *out){
+    const Post *p = posts_find(&app->posts, id);
+    if (p){ *out = *p; return 1; }
+    return app->lsm ? lsm_get(app->lsm, id, out) : 0;
+}
+/* Page of posts older than below_id (INT_MAX for the newest), newest
+ * first: memtable, then the disk runs. */
+int app_posts_before(App *app, int below_id, Post *out, int max){
+    const PostArray *pa = &app->posts;
+    int lo=0, hi=pa->size;                  /* first memtable index with id >= below_id */
+    while (lo < hi){ int mid=(lo+hi)/2; if (pa->data[mid].id < below_id) lo=mid+1; else hi=mid; }
+    int n = 0;
+    for (int i=lo-1; i>=0 && n<max; --i) out[n++] = pa->data[i];
+    if (n < max && app->lsm) n += lsm_before(app->lsm, n ? out[n-1].id : below_id, out+n, max-n);
+    return n;
+}
+/* Every change to a user record ends here: write it through to the disk
+ * store. */
+static void app_user_sync(App *app, UserNode *n){
+    if (!n || !app->ustore) return;
+    User u; users_get(&app->users, n->id, &u);
+    ustore_update(app->ustore, &u);
+}
+
+/* ====== Snapshots (MVCC) ====== */
+static unsigned mv_newest_pin(const Mvcc *m){
+    unsigned e = 0;
+    for (int i=0;i<m->npins;i++) if (m->pins[i] > e) e = m->pins[i];
+    return e;
+}
+static MvEntry* mv_append(Mvcc *m, int kind, int a, int b){
+    if (m->n == m->cap){
+        int nc = m->cap ? m->cap*2 : 64;
+        MvEntry *nl = (MvEntry*)realloc(m->log, sizeof *nl * (size_t)nc);
+        if (!nl) return NULL;
+        m->log = nl; m->cap = nc;
+    }
+    MvEntry *e = &m->log[m->n++];
+    e->epoch = ++m->epoch; e->kind = kind; e->a = a; e->b = b;
+    e->followers = e->following = 0;
+    return e;
+}
+/* Writers call these just before changing a record. Nothing is logged
+ * unless a snapshot is pinned, and a user record only once per pin. */
+static void mv_user(App *app, UserNode *n){
+    Mvcc *m = &app->mvcc;
+    if (!m->npins || !n) return;
+    UserHot *h = user_hot(&app->users, n);
+    if (h->mv_epoch > mv_newest_pin(m)) return;
+    MvEntry *e = mv_append(m, MV_USER, n->id, 0);
+    if (!e) return;
+    e->followers = h->followers; e->following = h->following;
+    h->mv_epoch = e->epoch;
+}
+static void mv_edge(App *app, const char *from, const char *to){
+    Mvcc *m = &app->mvcc;
+    if (!m->npins) return;
+    GraphUser *gu = graph_find(&app->graph, from);
+    int to_id = graph_name_id(&app->graph, to);
+    if (!gu || to_id < 0) return;
+    MvEntry *e = mv_append(m, MV_EDGE, gu->id, to_id);
+    if (!e) return;
+    e->following = graph_has(&app->graph, gu, GRAPH_FOLLOWING, to);
+    gu->mv_epoch = e->epoch;
+}
+/* Index of the first entry logged after epoch; the log is in epoch order. */
+static int mv_first_after(const Mvcc *m, unsigned epoch){
+    int lo = 0, hi = m->n;
+    while (lo < hi){ int mid=(lo+hi)/2; if (m->log[mid].epoch <= epoch) lo = mid+1; else hi = mid; }
+    return lo;
+}
+
+int snap_pin(App *app, Snapshot *s){
+    Mvcc *m = &app->mvcc;
+    if (m->npins == SNAP_MAX_PINS) return 0;
+    s->epoch = m->epoch;
+    m->pins[m->npins++] = s->epoch;
+    s->nusers = app->users.count;
+    Post p;
+    s->post_hi = app_posts_before(app, INT_MAX, &p, 1) ? p.id+1 : 0;
+    return 1;
+}
+/* Unpin, dropping versions no remaining snapshot can ask for. */
+void snap_release(App *app, Snapshot *s){
+    Mvcc *m = &app->mvcc;
+    for (int i=0;i<m->npins;i++)
+        if (m->pins[i] == s->epoch){ m->pins[i] = m->pins[--m->npins]; break; }
+    if (!m->npins){ free(m->log); m->log = NULL; m->n = m->cap = 0; return; }
+    unsigned oldest = m->pins[0];
+    for (int i=1;i<m->npins;i++) if (m->pins[i] < oldest) oldest = m->pins[i];
+    int drop = mv_first_after(m, oldest);
+    memmove(m->log, m->log + drop, sizeof *m->log * (size_t)(m->n - drop));
+    m->n -= drop;
+}
+/* User slot id as of the snapshot; 0 if it did not exist yet. */
+int snap_user(const App *app, const Snapshot *s, int id, User *out){
+    if (id < 0 || id >= s->nusers) return 0;
+    users_get(&app->users, id, out);
+    if (app->users.hot[id].mv_epoch <= s->epoch) return 1;
+    const Mvcc *m = &app->mvcc;
+    for (int i=mv_first_after(m, s->epoch); i<m->n; i++){
+        const MvEntry *e = &m->log[i];
+        if (e->kind == MV_USER && e->a == id){ out->followers = e->followers; out->following = e->following; break; }
+    }
+    return 1;
+}
+typedef struct SnapVisit { const Graph *g; const Roaring *changed; int (*fn)(void *ctx, const char *name); void *ctx; int n, stop; } SnapVisit;
+static int snap_visit_live(void *ctx, const char *name){
+    SnapVisit *v = (SnapVisit*)ctx;
+    int id = graph_name_id(v->g, name);
+    if (id >= 0 && roar_contains(v->changed, (unsigned)id)) return 1;
+    v->n++;
+    if (!v->fn(v->ctx, name)){ v->stop = 1; return 0; }
+    return 1;
+}
+static int snap_visit_old(void *ctx, unsigned id){
+    SnapVisit *v = (SnapVisit*)ctx;
+    v->n++;
+    return v->fn(v->ctx, v->g->names[id].s);
+}
+/* Who gu followed as of the snapshot: the live set minus every edge
+ * touched since, plus those of them that existed at the snapshot. */
+int snap_following(const App *app, const Snapshot *s, const GraphUser *gu, int (*fn)(void *ctx, const char *name), void *ctx){
+    const Mvcc *m = &app->mvcc;
+    Roaring changed, existed; roar_init(&changed); roar_init(&existed);
+    if (gu->mv_epoch > s->epoch)
+        for (int i=mv_first_after(m, s->epoch); i<m->n; i++){
+            const MvEntry *e = &m->log[i];
+            if (e->kind == MV_EDGE && e->a == gu->id && roar_add(&changed, (unsigned)e->b) && e->following)
+                roar_add(&existed, (unsigned)e->b);
+        }
+    SnapVisit v = { &app->graph, &changed, fn, ctx, 0, 0 };
+    graph_foreach(&app->graph, gu, GRAPH_FOLLOWING, snap_visit_live, &v);
+    if (!v.stop) roar_foreach(&existed, snap_visit_old, &v);
+    roar_free(&changed); roar_free(&existed);
+    return v.n;
+}
+
+/* Export users, follows and posts as of one snapshot. The work is sliced
+ * by app_export_step so commands keep running while it is written. Users
+ * still on the --user-store disk tree are outside the snapshot (they get
+ * a slot only when faulted in), so export refuses to run with a store. */
+int app_export_start(App *app, const char *path){
+    if (app->ustore || (app->export && app->export->f)) return 0;
+    free(app->export); app->export = NULL;
+    Export *x = (Export*)calloc(1, sizeof *x);
+    if (!x) return 0;
+    if (!(x->f = fopen(path,"w"))){ free(x); return 0; }
+    if (!snap_pin(app, &x->snap)){ fclose(x->f); free(x); return 0; }
+    strncpy(x->path, path, sizeof x->path-1);
+    x->gu = app->graph.head;
+    x->below = x->snap.post_hi;
+    fprintf(x->f, "# snapshot epoch %u: %d users, posts below #%d\n", x->snap.epoch, x->snap.nusers, x->snap.post_hi);
+    app->export = x;
+    return 1;
 }
-void posts_free(PostArray *pa) {
-    free(pa->data); pa->data = NULL; pa->size = pa->cap = 0;
+/* One TSV field: backslash, tab, CR and newline are written as \\, \t,
+ * \r and \n so every row stays on one line. */
+static void export_field(FILE *f, const char *s){
+    fputc('\t', f);
+    for (; *s; s++)
+        switch (*s){
+        case '\\': fputs("\\\\", f); break;
+        case '\t': fputs("\\t", f); break;
+        case '\r': fputs("\\r", f); break;
+        case '\n': fputs("\\n", f); break;
+        default: fputc(*s, f);
+        }
 }
-int posts_add(PostArray *pa, const Post *p) {
-    if (pa->size >= MAX_POSTS) return 0; /* hard stop for demo */
-    if (pa->size == pa->cap) {
-        int nc = pa->cap*2; if (nc > MAX_POSTS) nc = MAX_POSTS;
-        Post *tmp = (Post*)realloc(pa->data, sizeof(Post)*nc);
-        if (!tmp) return 0;
-        pa->data = tmp; pa->cap = nc;
-    }
-    pa->data[pa->size++] = *p; return 1;
+static int export_edge(void *ctx, const char *name){
+    Export *x = (Export*)ctx;
+    fputc('F', x->f); export_field(x->f, x->gu->username); export_field(x->f, name); fputc('\n', x->f);
+    x->edges++;
+    return 1;
 }
-void posts_list_desc(const PostArray *pa) {
-    if (pa->size == 0) { puts("No posts yet."); return; }
-    puts("Posts (newest first):");
-    for (int i = pa->size-1; i >= 0; --i) {
-        const Post *p = &pa->data[i];
-        printf(" #%d by %s at %s: %s\n", p->id, p->author, p->timestamp, p->content);
+/* Write about budget rows of the running export. Returns 1 on the call
+ * that finishes it; app->export then holds the totals. */
+int app_export_step(App *app, int budget){
+    Export *x = app->export;
+    if (!x || !x->f) return 0;
+    while (budget > 0 && x->phase < 3){
+        if (x->phase == 0){
+            User u;
+            if (!snap_user(app, &x->snap, x->user, &u)){ x->phase++; continue; }
+            fputc('U', x->f); export_field(x->f, u.username);
+            fprintf(x->f, "\t%d\t%d\n", u.followers, u.following);
+            x->user++; x->users++; budget--;
+        } else if (x->phase == 1){
+            if (!x->gu){ x->phase++; continue; }
+            UserNode *n = bst_find(&app->users, app->users_bst, x->gu->username);
+            if (n && n->id < x->snap.nusers) budget -= snap_following(app, &x->snap, x->gu, export_edge, x);
+            budget--;
+            x->gu = x->gu->next;
+        } else {
+            Post p[16];
+            int k = app_posts_before(app, x->below, p, 16);
+            if (!k){ x->phase++; continue; }
+            for (int i=0;i<k;i++){
+                fprintf(x->f, "P\t%d", p[i].id);
+                export_field(x->f, p[i].author); export_field(x->f, p[i].timestamp); export_field(x->f, p[i].content);
+                fputc('\n', x->f);
+            }
+            x->below = p[k-1].id; x->posts += k; budget -= k;
+        }
     }
+    if (x->phase < 3) return 0;
+    fclose(x->f); x->f = NULL;
+    snap_release(app, &x->snap);
+    return 1;
 }
 
-/* ====== Queue (Circular, fixed-cap) ====== */
-void mq_init(MessageQueue *q){ q->head=q->tail=q->count=0; }
-int mq_enqueue(MessageQueue *q, const Message *m){
-    if (q->count == MAX_MESSAGES) return 0;
-    q->buf[q->tail] = *m;
-    q->tail = (q->tail + 1) % MAX_MESSAGES;
-    q->count++;
+/* Follow/unfollow = graph edge + both users' counters. Shared by the UI and
+ * by replication so both paths keep the counters in step with the graph;
+ * replication passes the leader's follow time through. */
+static int app_follow_at(App *app, const char *from, const char *to, unsigned when){
+    UserNode *f=app_user_find(app,from), *t=app_user_find(app,to);
+    mv_edge(app, from, to); mv_user(app, f); mv_user(app, t);
+    if (!graph_add_edge(&app->graph, from, to, when)) return 0;
+    app_feed_invalidate(app, from);
+    app->warm_edges++;
+    if (f){ user_hot(&app->users,f)->following++; app_user_sync(app,f); }
+    if (t){ user_hot(&app->users,t)->followers++; app_user_sync(app,t); }
+    cdc_follow(&app->cdc, CDC_FOLLOW, from, to, when);
     return 1;
 }
-int mq_dequeue(MessageQueue *q, Message *out){
-    if (q->count == 0) return 0;
-    if (out) *out = q->buf[q->head];
-    q->head = (q->head + 1) % MAX_MESSAGES;
-    q->count--;
+static int app_unfollow_at(App *app, const char *from, const char *to, unsigned when){
+    UserNode *f=app_user_find(app,from), *t=app_user_find(app,to);
+    mv_edge(app, from, to); mv_user(app, f); mv_user(app, t);
+    if (!graph_remove_edge(&app->graph, from, to, when)) return 0;
+    app_feed_invalidate(app, from);
+    app->warm_edges++;
+    UserHot *fh = f ? user_hot(&app->users,f) : NULL, *th = t ? user_hot(&app->users,t) : NULL;
+    if (fh){ if (fh->following>0) fh->following--; app_user_sync(app,f); }
+    if (th){ if (th->followers>0) th->followers--; app_user_sync(app,t); }
+    cdc_follow(&app->cdc, CDC_UNFOLLOW, from, to, when);
     return 1;
 }
-void mq_print(const MessageQueue *q){
-    if (q->count == 0) { puts("Message queue is empty."); return; }
-    puts("Messages in queue (front..back):");
-    for (int i=0, idx=q->head; i<q->count; ++i, idx=(idx+1)%MAX_MESSAGES){
-        const Message *m = &q->buf[idx];
-        printf(" from:%s -> to:%s at %s | %.80s\n", m->from, m->to, m->timestamp, m->content);
+int app_follow(App *app, const char *from, const char *to){ return app_follow_at(app, from, to, (unsigned)time(NULL)); }
+int app_unfollow(App *app, const char *from, const char *to){ return app_unfollow_at(app, from, to, (unsigned)time(NULL)); }
+
+/* Batch form for onboarding-style bulk follows: the graph edges go in with
+ * one pass (graph_edges_many) and the follower's counter and store record
+ * are written once; each edge still gets its own CDC record so replicas
+ * replay it through app_follow. Returns how many edges changed. */
+int app_follow_many(App *app, const char *from, const char *const *to, int n, int follow){
+    UserNode *f = app_user_find(app, from);
+    if (!f || n <= 0) return 0;
+    for (int i=0;i<n;i++){
+        UserNode *t = app_user_find(app, to[i]);       /* fault in stored users */
+        if (t){ mv_edge(app, from, to[i]); mv_user(app, t); }
+    }
+    mv_user(app, f);
+    unsigned char *changed = (unsigned char*)malloc((size_t)n);
+    if (!changed) return 0;
+    unsigned when = (unsigned)time(NULL);
+    int done = graph_edges_many(&app->graph, from, to, n, follow, when, changed);
+    for (int i=0;i<n && done;i++){
+        if (!changed[i]) continue;
+        UserNode *t = app_user_find(app, to[i]);
+        UserHot *th = t ? user_hot(&app->users,t) : NULL;
+        if (th){
+            if (follow) th->followers++; else if (th->followers>0) th->followers--;
+            app_user_sync(app,t);
+        }
+        cdc_follow(&app->cdc, follow ? CDC_FOLLOW : CDC_UNFOLLOW, from, to[i], when);
     }
+    free(changed);
+    if (!done) return 0;
+    UserHot *fh = user_hot(&app->users,f);
+    fh->following = follow ? fh->following + done : (fh->following > done ? fh->following - done : 0);
+    app_user_sync(app,f);
+    app_feed_invalidate(app, from);
+    app->warm_edges += (unsigned long)done;
+    return done;
 }
 
-/* ====== BST (Users) ====== */
-static UserNode* make_user(const char *u, const char *p){
-    UserNode *n=(UserNode*)calloc(1,sizeof(UserNode));
-    if (!n) return NULL;
-    strncpy(n->user.username,u,USERNAME_MAX-1);
-    strncpy(n->user.password,p,PASSWORD_MAX-1);
-    return n;
+/* ====== Transactions ====== */
+void txn_begin(Txn *t, App *app){ t->app = app; t->nops = t->failed = 0; }
+static int txn_queue(Txn *t, int type, const char *a, const char *b){
+    if (t->nops == TXN_MAX_OPS || !app_user_find(t->app,a) || !app_user_find(t->app,b) || strcmp(a,b)==0){ t->failed = 1; return 0; }
+    TxnOp *op = &t->ops[t->nops++];
+    op->type = type;
+    strncpy(op->a,a,USERNAME_MAX-1); op->a[USERNAME_MAX-1]='\0';
+    strncpy(op->b,b,USERNAME_MAX-1); op->b[USERNAME_MAX-1]='\0';
+    return 1;
 }
-UserNode* bst_insert(UserNode *root, const char *username, const char *password, int *ok){
-    if (!root){ *ok=1; return make_user(username,password); }
-    int c = strcmp(username, root->user.username);
-    if (c==0){ *ok=0; return root; }
-    if (c<0) root->left = bst_insert(root->left, username, password, ok);
-    else     root->right= bst_insert(root->right,username, password, ok);
-    return root;
+int txn_follow(Txn *t, const char *from, const char *to){ return txn_queue(t, TXN_FOLLOW, from, to); }
+int txn_unfollow(Txn *t, const char *from, const char *to){ return txn_queue(t, TXN_UNFOLLOW, from, to); }
+
+/* Whether a->b exists once the ops before op i have been applied. */
+static int txn_edge_after(const Txn *t, int i, GraphUser *gu){
+    const TxnOp *op = &t->ops[i];
+    for (int j=i-1;j>=0;j--)
+        if (strcmp(t->ops[j].a, op->a)==0 && strcmp(t->ops[j].b, op->b)==0) return t->ops[j].type == TXN_FOLLOW;
+    return graph_has(&t->app->graph, gu, GRAPH_FOLLOWING, op->b);
 }
-UserNode* bst_find(UserNode *root, const char *username){
-    if (!root) return NULL;
-    int c = strcmp(username, root->user.username);
-    if (c==0) return root;
-    if (c<0)  return bst_find(root->left, username);
-    return bst_find(root->right, username);
+/* An op is valid only if it changes something: following twice or
+ * dropping a missing edge fails the transaction instead of skewing the
+ * counters. Every op is checked, with the earlier ops' effects folded in,
+ * before any of them is applied. */
+static int txn_check(const Txn *t){
+    Graph *g = &t->app->graph;
+    for (int i=0;i<t->nops;i++){
+        const TxnOp *op = &t->ops[i];
+        GraphUser *gu = graph_find(g, op->a);
+        if (!gu || !graph_find(g, op->b) || strcmp(op->a, op->b)==0) return 0;
+        if (txn_edge_after(t, i, gu) == (op->type == TXN_FOLLOW)) return 0;
+    }
+    return 1;
 }
-void bst_free(UserNode *root){
-    if (!root) return;
-    bst_free(root->left); bst_free(root->right); free(root);
+/* Validate every op, then apply them in order. TXN_FAILED from the check
+ * means nothing was applied. */
+int txn_commit(Txn *t){
+    App *app = t->app;
+    if (t->failed || !t->nops || !txn_check(t)){ app->txn_aborts++; return TXN_FAILED; }
+    for (int i=0;i<t->nops;i++){
+        const TxnOp *op = &t->ops[i];
+        int ok = op->type == TXN_FOLLOW ? app_follow(app, op->a, op->b) : app_unfollow(app, op->a, op->b);
+        if (!ok){ app->txn_aborts++; return TXN_FAILED; }
+    }
+    app->txn_commits++;
+    return TXN_OK;
 }
 
-/* ====== Graph (Adjacency) ====== */
-void graph_init(Graph *g){ g->head=NULL; g->user_count=0; }
+/* Replay one mutation from the leader's log. */
+int app_apply(App *app, const CdcEvent *ev){
+    switch (ev->type){
+    case CDC_REGISTER: {
+        int ok=0; app->users_bst = bst_insert(&app->users, app->users_bst, ev->a, ev->b, &ok);
+        if (ok) graph_add_user(&app->graph, ev->a);
+        return ok;
+    }
+    case CDC_FOLLOW:   return app_follow_at(app, ev->a, ev->b, ev->follow_time);
+    case CDC_UNFOLLOW: return app_unfollow_at(app, ev->a, ev->b, ev->follow_time);
+    case CDC_POST: {
+        Post p; p.id = ev->post_id;
+        strncpy(p.author, ev->a, USERNAME_MAX-1); p.author[USERNAME_MAX-1]='\0';
+        strncpy(p.timestamp, ev->timestamp, TIMESTAMP_MAX-1); p.timestamp[TIMESTAMP_MAX-1]='\0';
+        strncpy(p.content, ev->content, CONTENT_MAX-1); p.content[CONTENT_MAX-1]='\0';
+        return posts_add(&app->posts, &p);
+    }
+    case CDC_MESSAGE: {
+        Message m;
+        strncpy(m.from, ev->a, USERNAME_MAX-1); m.from[USERNAME_MAX-1]='\0';
+        strncpy(m.to, ev->b, USERNAME_MAX-1); m.to[USERNAME_MAX-1]='\0';
+        strncpy(m.timestamp, ev->timestamp, TIMESTAMP_MAX-1); m.timestamp[TIMESTAMP_MAX-1]='\0';
+        strncpy(m.content, ev->content, CONTENT_MAX-1); m.content[CONTENT_MAX-1]='\0';
+        return mq_enqueue(&app->mq, &m);
+    }
+    case CDC_DELIVER:  return mq_dequeue(&app->mq, NULL);
+    }
+    return 0;
+}
 
-GraphUser* graph_find(Graph *g, const char *username){
-    for (GraphUser *cu=g->head; cu; cu=cu->next)
-        if (strcmp(cu->username, username)==0) return cu;
-    return NULL;
+void app_free(App *app){
+    lsm_close(app->lsm, &app->posts); app->lsm = NULL;   /* flushes the memtable */
+    bst_free(app->users_bst);
+    users_free(&app->users);
+    posts_free(&app->posts);
+    free(app->warm); app->warm = NULL; app->nwarm = 0;
+    if (app->export){
+        if (app->export->f){ fclose(app->export->f); snap_release(app, &app->export->snap); }
+        free(app->export); app->export = NULL;
+    }
+    free(app->mvcc.log); memset(&app->mvcc, 0, sizeof app->mvcc);
+    graph_free(&app->graph);
+    pubsub_free(&app->subs);
+    cdc_close(&app->cdc);
+    replica_close(&app->replica);
+    if (app->delivery){ shmring_close(app->delivery); free(app->delivery); app->delivery = NULL; }
+    ustore_close(app->ustore); app->ustore = NULL;
 }
-static AdjNode* adj_prepend(AdjNode *head, const char *u){
-    AdjNode *n=(AdjNode*)malloc(sizeof(AdjNode));
-    if (!n) return head;
-    strncpy(n->username,u,USERNAME_MAX-1); n->username[USERNAME_MAX-1]='\0';
-    n->next=head; return n;
+
+/* ====== Sharding (shard server + router) ====== */
+/* FNV-1a; stable across processes so every router agrees on placement. */
+unsigned shard_of(const char *username, int nshards){
+    unsigned h = 2166136261u;
+    for (const unsigned char *p=(const unsigned char*)username; *p; ++p){ h ^= *p; h *= 16777619u; }
+    return h % (unsigned)nshards;
 }
-static int adj_has(AdjNode *head, const char *u){
-    for (; head; head=head->next) if (strcmp(head->username,u)==0) return 1;
-    return 0;
+
+static char* next_tok(char **s){
+    while (**s==' ') (*s)++;
+    if (!**s) return NULL;
+    char *t=*s;
+    while (**s && **s!=' ') (*s)++;
+    if (**s) *(*s)++='\0';
+    return t;
 }
-static AdjNode* adj_remove(AdjNode *head, const char *u, int *removed){
-    AdjNode *cur=head,*prev=NULL; *removed=0;
-    while(cur){
-        if(strcmp(cur->username,u)==0){
-            *removed=1;
-            if(prev) prev->next=cur->next; else head=cur->next;
-            free(cur); break;
+
+#ifdef _WIN32
+int shard_serve(App *app, const char *path){ (void)app; (void)path; return 0; }
+int router_run(const char *shard_paths){ (void)shard_paths; (void)next_tok; return 0; }
+#else
+/* Shard protocol: one request line, one reply line ("OK ..." / "ERR ...");
+ * listings reply with one "- item" line per item terminated by ".", so an
+ * item can never be mistaken for the terminator. A shard owns
+ * the users that hash to it; for a cross-shard follow each side keeps its
+ * own half of the edge. */
+static int print_line(void *ctx, const char *name){ fprintf((FILE*)ctx, "- %s\n", name); return 1; }
+static void shard_exec(App *app, char *line, FILE *out){
+    char *s=line, *cmd=next_tok(&s), *a=NULL, *b=NULL;
+    if (!cmd){ fputs("ERR empty\n",out); return; }
+    if (strcmp(cmd,"REGISTER")==0){
+        a=next_tok(&s); b=next_tok(&s);
+        if (!a || !b || !valid_name(a) || strlen(b)>=PASSWORD_MAX){ fputs("ERR invalid\n",out); return; }
+        int ok=0; app->users_bst = bst_insert(&app->users, app->users_bst,a,b,&ok);
+        if (!ok){ fputs("ERR exists\n",out); return; }
+        graph_add_user(&app->graph,a);
+        cdc_register(&app->cdc, a, b);
+        fputs("OK\n",out);
+    } else if (strcmp(cmd,"AUTH")==0){
+        a=next_tok(&s); b=next_tok(&s);
+        UserNode *n = a ? bst_find(&app->users, app->users_bst,a) : NULL;
+        fputs(n && b && strcmp(user_cold(&app->users,n)->password,b)==0 ? "OK\n" : "ERR credentials\n", out);
+    } else if (strcmp(cmd,"EXISTS")==0){
+        a=next_tok(&s);
+        fputs(a && bst_find(&app->users, app->users_bst,a) ? "OK\n" : "ERR not found\n", out);
+    } else if (strcmp(cmd,"FOLLOW_OUT")==0 || strcmp(cmd,"FOLLOW_IN")==0
+            || strcmp(cmd,"UNFOLLOW_OUT")==0 || strcmp(cmd,"UNFOLLOW_IN")==0){
+        a=next_tok(&s); b=next_tok(&s);
+        UserNode *n = a ? bst_find(&app->users, app->users_bst,a) : NULL;
+        if (!n || !b){ fputs("ERR not found\n",out); return; }
+        int follow = cmd[0]=='F', outward = strstr(cmd,"_OUT")!=NULL;
+        int side = outward ? GRAPH_FOLLOWING : GRAPH_FOLLOWERS;
+        UserHot *uh = user_hot(&app->users,n);
+        int *counter = outward ? &uh->following : &uh->followers;
+        int ok = follow ? graph_add_half_edge(&app->graph,a,b,side)
+                        : graph_remove_half_edge(&app->graph,a,b,side);
+        if (ok){
+            if (follow) (*counter)++; else if (*counter>0) (*counter)--;
+            if (outward) cdc_follow(&app->cdc, follow ? CDC_FOLLOW : CDC_UNFOLLOW, a, b, (unsigned)time(NULL));
         }
-        prev=cur; cur=cur->next;
-    }
-    return head;
+        fputs(ok ? "OK\n" : "ERR no change\n", out);
+    } else if (strcmp(cmd,"FOLLOW_IN_MANY")==0 || strcmp(cmd,"UNFOLLOW_IN_MANY")==0){
+        /* every listed target on this shard gains/loses follower a; lists
+         * the targets that changed */
+        int follow = cmd[0]=='F';
+        a=next_tok(&s);
+        while (a && (b=next_tok(&s))){
+            UserNode *n = bst_find(&app->users, app->users_bst,b);
+            if (!n) continue;
+            int ok = follow ? graph_add_half_edge(&app->graph,b,a,GRAPH_FOLLOWERS)
+                            : graph_remove_half_edge(&app->graph,b,a,GRAPH_FOLLOWERS);
+            if (!ok) continue;
+            UserHot *uh = user_hot(&app->users,n);
+            if (follow) uh->followers++; else if (uh->followers>0) uh->followers--;
+            fprintf(out,"- %s\n",b);
+        }
+        fputs(".\n",out);
+    } else if (strcmp(cmd,"FOLLOW_OUT_MANY")==0 || strcmp(cmd,"UNFOLLOW_OUT_MANY")==0){
+        int follow = cmd[0]=='F', k = 0;
+        a=next_tok(&s);
+        UserNode *n = a ? bst_find(&app->users, app->users_bst,a) : NULL;
+        if (!n){ fputs("ERR not found\n",out); return; }
+        while ((b=next_tok(&s))){
+            int ok = follow ? graph_add_half_edge(&app->graph,a,b,GRAPH_FOLLOWING)
+                            : graph_remove_half_edge(&app->graph,a,b,GRAPH_FOLLOWING);
+            if (!ok) continue;
+            cdc_follow(&app->cdc, follow ? CDC_FOLLOW : CDC_UNFOLLOW, a, b, (unsigned)time(NULL));
+            k++;
+        }
+        UserHot *uh = user_hot(&app->users,n);
+        uh->following = follow ? uh->following + k : (uh->following > k ? uh->following - k : 0);
+        fprintf(out,"OK %d\n",k);
+    } else if (strcmp(cmd,"POST")==0){
+        char *id=next_tok(&s); a=next_tok(&s);
+        if (!id || !a || !*s || !bst_find(&app->users, app->users_bst,a)){ fputs("ERR invalid\n",out); return; }
+        Post p; p.id=(int)strtol(id,NULL,10);
+        strncpy(p.author,a,USERNAME_MAX-1); p.author[USERNAME_MAX-1]='\0';
+        strncpy(p.content,s,CONTENT_MAX-1); p.content[CONTENT_MAX-1]='\0';
+        format_timestamp(p.timestamp, TIMESTAMP_MAX);
+        fputs(posts_add(&app->posts,&p) ? "OK\n" : "ERR full\n", out);
+    } else if (strcmp(cmd,"POSTS")==0){
+        for (int i=0;i<app->posts.size;i++){
+            const Post *p=&app->posts.data[i];
+            fprintf(out,"- %d\t%s\t%s\t%s\n", p->id, p->author, p->timestamp, p->content);
+        }
+        fputs(".\n",out);
+    } else if (strcmp(cmd,"FOLLOWING")==0 || strcmp(cmd,"FOLLOWERS")==0){
+        a=next_tok(&s);
+        GraphUser *gu = a ? graph_find(&app->graph,a) : NULL;
+        if (gu) graph_foreach(&app->graph, gu, cmd[6]=='I' ? GRAPH_FOLLOWING : GRAPH_FOLLOWERS, print_line, out);
+        fputs(".\n",out);
+    } else if (strcmp(cmd,"MSG")==0){
+        a=next_tok(&s); b=next_tok(&s);
+        if (!a || !b || !*s){ fputs("ERR invalid\n",out); return; }
+        Message m;
+        strncpy(m.from,a,USERNAME_MAX-1); m.from[USERNAME_MAX-1]='\0';
+        strncpy(m.to,b,USERNAME_MAX-1); m.to[USERNAME_MAX-1]='\0';
+        strncpy(m.content,s,CONTENT_MAX-1); m.content[CONTENT_MAX-1]='\0';
+        format_timestamp(m.timestamp, TIMESTAMP_MAX);
+        if (!mq_enqueue(&app->mq,&m)){ fputs("ERR queue full\n",out); return; }
+        cdc_message(&app->cdc, CDC_MESSAGE, &m);
+        fputs("OK\n",out);
+    } else if (strcmp(cmd,"DELIVER")==0){
+        Message m;
+        if (!mq_dequeue(&app->mq,&m)){ fputs("ERR empty\n",out); return; }
+        cdc_message(&app->cdc, CDC_DELIVER, &m);
+        fprintf(out,"OK %s -> %s | %s\n", m.from, m.to, m.content);
+    } else if (strcmp(cmd,"MAXID")==0){
+        Post p;
+        fprintf(out,"OK %d\n", app_posts_before(app, INT_MAX, &p, 1) ? p.id : 0);
+    } else if (strcmp(cmd,"STATS")==0){
+        fprintf(out,"OK users=%d posts=%d queued=%d\n", app->graph.user_count, app->posts.size, app->mq.count);
+    } else fputs("ERR unknown command\n",out);
 }
-int graph_add_user(Graph *g, const char *username){
-    if (graph_find(g, username)) return 1;
-    if (g->user_count >= MAX_USERS) return 0;
-    GraphUser *nu=(GraphUser*)calloc(1,sizeof(GraphUser));
-    if (!nu) return 0;
-    strncpy(nu->username, username, USERNAME_MAX-1);
-    nu->next = g->head; g->head = nu; g->user_count++;
+
+/* Serve one router connection at a time until a SHUTDOWN request. */
+int shard_serve(App *app, const char *path){
+    int lfd = unix_listen(path);
+    if (lfd < 0) return 0;
+    fcntl(lfd, F_SETFL, fcntl(lfd,F_GETFL) & ~O_NONBLOCK);
+    int running = 1;
+    while (running){
+        int fd = accept(lfd,NULL,NULL);
+        if (fd < 0){ if (errno==EINTR) continue; break; }
+        LineReader in;
+        FILE *out = fdopen(fd,"w");
+        if (!out || !lr_init(&in,fd)){ if (out) fclose(out); else close(fd); continue; }
+        char *line; size_t len;
+        while (lr_next(&in,&line,&len)){
+            if (strcmp(line,"SHUTDOWN")==0){ fputs("OK\n",out); running=0; break; }
+            shard_exec(app,line,out);
+            fflush(out);
+            cdc_flush(&app->cdc);
+        }
+        lr_free(&in); fclose(out);
+    }
+    close(lfd); unlink(path);
     return 1;
 }
-int graph_add_edge(Graph *g, const char *from, const char *to){
-    GraphUser *A=graph_find(g,from), *B=graph_find(g,to);
-    if (!A||!B || strcmp(from,to)==0) return 0;
-    if (!adj_has(A->following,to)) A->following = adj_prepend(A->following,to);
-    if (!adj_has(B->followers,from)) B->followers = adj_prepend(B->followers,from);
+
+typedef struct ShardConn { FILE *in, *out; } ShardConn;
+
+/* Send one request; the first reply line lands in reply. Returns 1 on "OK". */
+static int shard_call(ShardConn *sc, char *reply, int n, const char *fmt, ...){
+    va_list ap; va_start(ap,fmt); vfprintf(sc->out,fmt,ap); va_end(ap);
+    fputc('\n',sc->out); fflush(sc->out);
+    if (!fgets(reply,n,sc->in)){ snprintf(reply,(size_t)n,"ERR shard down"); return 0; }
+    reply[strcspn(reply,"\r\n")]='\0';
+    return strncmp(reply,"OK",2)==0;
+}
+/* Strip the "- " item prefix; 0 for the terminator or an error reply. */
+static int listing_item(char *reply){
+    if (strncmp(reply,"- ",2)!=0) return 0;
+    memmove(reply, reply+2, strlen(reply+2)+1);
     return 1;
 }
-int graph_remove_edge(Graph *g, const char *from, const char *to){
-    GraphUser *A=graph_find(g,from), *B=graph_find(g,to);
-    if (!A||!B) return 0;
-    int r1=0,r2=0;
-    A->following = adj_remove(A->following,to,&r1);
-    B->followers = adj_remove(B->followers,from,&r2);
-    return r1&&r2;
+/* Read a "."-terminated listing; reply holds each item in turn. */
+static int shard_next_item(ShardConn *sc, char *reply, int n){
+    if (!fgets(reply,n,sc->in)) return 0;
+    reply[strcspn(reply,"\r\n")]='\0';
+    return listing_item(reply);
 }
-void graph_show_following(Graph *g, const char *u){
-    GraphUser *gu = graph_find(g,u);
-    if (!gu){ printf("User '%s' not found.\n", u); return; }
-    printf("%s follows:\n", u);
-    int c=0; for (AdjNode *a=gu->following; a; a=a->next){ printf(" - %s\n", a->username); c++; }
-    if (!c) puts(" (none)");
+static int post_cmp_desc(const void *a, const void *b){
+    return ((const Post*)b)->id - ((const Post*)a)->id;
 }
-void graph_show_followers(Graph *g, const char *u){
-    GraphUser *gu = graph_find(g,u);
-    if (!gu){ printf("User '%s' not found.\n", u); return; }
-    printf("%s is followed by:\n", u);
-    int c=0; for (AdjNode *a=gu->followers; a; a=a->next){ printf(" - %s\n", a->username); c++; }
-    if (!c) puts(" (none)");
+typedef struct RouteName { unsigned shard; const char *name; } RouteName;
+static int route_name_cmp(const void *a, const void *b){
+    const RouteName *x=(const RouteName*)a, *y=(const RouteName*)b;
+    if (x->shard != y->shard) return x->shard < y->shard ? -1 : 1;
+    return strcmp(x->name, y->name);
 }
-void graph_free(Graph *g){
-    GraphUser *cu=g->head;
-    while(cu){
-        GraphUser *nx=cu->next;
-        AdjNode *a=cu->following; while(a){ AdjNode *an=a->next; free(a); a=an; }
-        a=cu->followers; while(a){ AdjNode *an=a->next; free(a); a=an; }
-        free(cu); cu=nx;
+/* Batch follow: targets are grouped by shard so each shard is called once
+ * for the follower halves, then the owner's shard once with the targets
+ * that took. Prints "OK <edges changed>". */
+static void router_follow_many(ShardConn *sh, int n, int follow, char *s, char *r, int rn){
+    const char *pre = follow ? "FOLLOW" : "UNFOLLOW";
+    char *a = next_tok(&s);
+    if (!a){ puts("ERR usage"); return; }
+    ShardConn *sa = &sh[shard_of(a,n)];
+    if (!shard_call(sa, r, rn, "EXISTS %s", a)){ puts(r); return; }
+    RouteName *t = NULL; int cnt = 0, cap = 0;
+    for (char *b; (b=next_tok(&s)); ){
+        if (strcmp(a,b)==0) continue;
+        if (cnt==cap){ cap = cap ? cap*2 : 16; RouteName *nt=(RouteName*)realloc(t,sizeof *t*(size_t)cap); if (!nt) break; t=nt; }
+        t[cnt].shard = shard_of(b,n); t[cnt].name = b; cnt++;
     }
-    g->head=NULL; g->user_count=0;
+    qsort(t, (size_t)cnt, sizeof *t, route_name_cmp);
+    StrBuf group, took; sb_init(&group); sb_init(&took);
+    for (int i=0;i<cnt; ){
+        unsigned sid = t[i].shard;
+        group.len = 0;
+        for (; i<cnt && t[i].shard==sid; i++)
+            if (i==0 || strcmp(t[i].name,t[i-1].name)!=0) sb_printf(&group," %s",t[i].name);
+        shard_call(&sh[sid], r, rn, "%s_IN_MANY %s%s", pre, a, group.data);
+        for (int more = listing_item(r); more; more = shard_next_item(&sh[sid], r, rn))
+            sb_printf(&took," %s",r);
+    }
+    if (!took.len) puts("OK 0");
+    else if (shard_call(sa, r, rn, "%s_OUT_MANY %s%s", pre, a, took.data)) puts(r);
+    else {
+        /* keep the two halves consistent: undo the follower sides */
+        char r2[CONTENT_MAX + 2*USERNAME_MAX + 32];
+        char *p = took.data, *b;
+        while ((b=next_tok(&p)))
+            shard_call(&sh[shard_of(b,n)], r2, sizeof r2, "%s_IN %s %s", follow ? "UNFOLLOW" : "FOLLOW", b, a);
+        puts(r);
+    }
+    sb_free(&group); sb_free(&took); free(t);
 }
 
-/* ====== App ====== */
-void app_init(App *app){
-    app->users_bst=NULL; app->current=NULL;
-    posts_init(&app->posts, 8);
-    mq_init(&app->mq);
-    graph_init(&app->graph);
-    app->admin.is_registered = 0;
-    app->current_admin = NULL;
-    app->max_users = MAX_USERS;
-    app->max_posts = MAX_POSTS;
-    app->max_messages = MAX_MESSAGES;
-}
-void app_free(App *app){
-    bst_free(app->users_bst);
-    posts_free(&app->posts);
-    graph_free(&app->graph);
+/* Router: reads operations from stdin, forwards each to the owning shard(s)
+ * and prints the outcome. Operations name their actor explicitly:
+ *   REGISTER u p | LOGIN u p | FOLLOW a b | UNFOLLOW a b | POST u text
+ *   FOLLOW_MANY a b... | UNFOLLOW_MANY a b...
+ *   POSTS | FOLLOWING u | FOLLOWERS u | MSG from to text | DELIVER | STATS | QUIT */
+int router_run(const char *shard_paths){
+    ShardConn sh[SHARD_MAX];
+    int n = 0;
+    char paths[SHARD_MAX*CDC_PATH_MAX];
+    strncpy(paths, shard_paths, sizeof paths-1); paths[sizeof paths-1]='\0';
+    for (char *save=NULL, *p=strtok_r(paths,",",&save); p; p=strtok_r(NULL,",",&save)){
+        int fd = n < SHARD_MAX ? unix_connect(p) : -1;
+        if (fd < 0){ fprintf(stderr,"Cannot reach shard %s\n", p); while (n) { n--; fclose(sh[n].in); fclose(sh[n].out); } return 0; }
+        sh[n].in = fdopen(fd,"r"); sh[n].out = fdopen(dup(fd),"w"); n++;
+    }
+    if (!n) return 0;
+
+    char *line, r[CONTENT_MAX + 2*USERNAME_MAX + 32], r2[sizeof r];
+    size_t len;
+    int next_id = 1, rr = 0;
+    /* post ids are global: resume past the highest one any shard holds */
+    for (int i=0;i<n;i++)
+        if (shard_call(&sh[i], r, sizeof r, "MAXID")){
+            int m = (int)strtol(r+2, NULL, 10);
+            if (m >= next_id) next_id = m+1;
+        }
+    while (lr_next(input_reader(),&line,&len)){
+        char *s=line, *cmd=next_tok(&s), *a, *b;
+        if (!cmd) continue;
+        if (strcmp(cmd,"QUIT")==0) break;
+        if (strcmp(cmd,"REGISTER")==0 || strcmp(cmd,"LOGIN")==0){
+            a=next_tok(&s); b=next_tok(&s);
+            if (!a || !b){ puts("ERR usage"); continue; }
+            shard_call(&sh[shard_of(a,n)], r, sizeof r, "%s %s %s", cmd[0]=='R' ? "REGISTER" : "AUTH", a, b);
+            puts(r);
+        } else if (strcmp(cmd,"FOLLOW")==0 || strcmp(cmd,"UNFOLLOW")==0){
+            a=next_tok(&s); b=next_tok(&s);
+            if (!a || !b || strcmp(a,b)==0){ puts("ERR usage"); continue; }
+            ShardConn *sa=&sh[shard_of(a,n)], *sb=&sh[shard_of(b,n)];
+            const char *pre = cmd[0]=='F' ? "FOLLOW" : "UNFOLLOW";
+            if (!shard_call(sb, r, sizeof r, "EXISTS %s", b)){ puts(r); continue; }
+            if (!shard_call(sa, r, sizeof r, "%s_OUT %s %s", pre, a, b)){ puts(r); continue; }
+            if (!shard_call(sb, r, sizeof r, "%s_IN %s %s", pre, b, a)){
+                /* keep the two halves consistent: undo the owner side */
+                shard_call(sa, r2, sizeof r2, "%s_OUT %s %s", cmd[0]=='F' ? "UNFOLLOW" : "FOLLOW", a, b);
+            }
+            puts(r);
+        } else if (strcmp(cmd,"FOLLOW_MANY")==0 || strcmp(cmd,"UNFOLLOW_MANY")==0){
+            router_follow_many(sh, n, cmd[0]=='F', s, r, sizeof r);
+        } else if (strcmp(cmd,"POST")==0){
+            a=next_tok(&s);
+            if (!a || !*s){ puts("ERR usage"); continue; }
+            if (shard_call(&sh[shard_of(a,n)], r, sizeof r, "POST %d %s %s", next_id, a, s))
+                printf("OK #%d\n", next_id++);
+            else puts(r);
+        } else if (strcmp(cmd,"POSTS")==0){
+            /* scatter-gather: every shard holds its own users' posts */
+            Post *all=NULL; int cnt=0, cap=0;
+            for (int i=0;i<n;i++){
+                shard_call(&sh[i], r, sizeof r, "POSTS");
+                for (int more = listing_item(r); more; more = shard_next_item(&sh[i], r, sizeof r)){
+                    if (cnt==cap){ cap = cap ? cap*2 : 64; Post *t=(Post*)realloc(all,sizeof(Post)*cap); if (!t) break; all=t; }
+                    Post *p=&all[cnt];
+                    char *f1=strchr(r,'\t'), *f2=f1?strchr(f1+1,'\t'):NULL, *f3=f2?strchr(f2+1,'\t'):NULL;
+                    if (!f3) continue;
+                    *f1=*f2=*f3='\0';
+                    p->id=(int)strtol(r,NULL,10);
+                    strncpy(p->author,f1+1,USERNAME_MAX-1); p->author[USERNAME_MAX-1]='\0';
+                    strncpy(p->timestamp,f2+1,TIMESTAMP_MAX-1); p->timestamp[TIMESTAMP_MAX-1]='\0';
+                    strncpy(p->content,f3+1,CONTENT_MAX-1); p->content[CONTENT_MAX-1]='\0';
+                    cnt++;
+                }
+            }
+            qsort(all,(size_t)cnt,sizeof(Post),post_cmp_desc);
+            for (int i=0;i<cnt;i++)
+                printf(" #%d by %s at %s: %s\n", all[i].id, all[i].author, all[i].timestamp, all[i].content);
+            puts(".");
+            free(all);
+        } else if (strcmp(cmd,"FOLLOWING")==0 || strcmp(cmd,"FOLLOWERS")==0){
+            a=next_tok(&s);
+            if (!a){ puts("ERR usage"); continue; }
+            ShardConn *sa=&sh[shard_of(a,n)];
+            shard_call(sa, r, sizeof r, "%s %s", cmd, a);
+            for (int more = listing_item(r); more; more = shard_next_item(sa, r, sizeof r))
+                printf(" - %s\n", r);
+            puts(".");
+        } else if (strcmp(cmd,"MSG")==0){
+            a=next_tok(&s); b=next_tok(&s);
+            if (!a || !b || !*s){ puts("ERR usage"); continue; }
+            if (!shard_call(&sh[shard_of(a,n)], r, sizeof r, "EXISTS %s", a)
+             || !shard_call(&sh[shard_of(b,n)], r, sizeof r, "EXISTS %s", b)){ puts(r); continue; }
+            /* the message waits on the recipient's shard */
+            shard_call(&sh[shard_of(b,n)], r, sizeof r, "MSG %s %s %s", a, b, s);
+            puts(r);
+        } else if (strcmp(cmd,"DELIVER")==0){
+            int ok=0;
+            for (int k=0;k<n && !ok;k++){ ok = shard_call(&sh[rr], r, sizeof r, "DELIVER"); rr=(rr+1)%n; }
+            puts(r);
+        } else if (strcmp(cmd,"STATS")==0){
+            for (int i=0;i<n;i++){ shard_call(&sh[i], r, sizeof r, "STATS"); printf("shard %d: %s\n", i, r); }
+        } else puts("ERR unknown command");
+        fflush(stdout);
+    }
+    for (int i=0;i<n;i++){ fclose(sh[i].in); fclose(sh[i].out); }
+    return 1;
 }
+#endif
 
 /* ====== UI Actions ====== */
+static const char* cur_name(App *app){ return user_cold(&app->users, app->current)->username; }
 static int session_required(App *app){
     if (!app->current){ puts("Please login first."); return 0; }
     return 1;
 }
+static int writable(App *app){
+    if (app->read_only){ puts("Read-only replica: writes go to the leader."); return 0; }
+    return 1;
+}
 
 void ui_register(App *app){
+    if (!writable(app)) return;
     if (app->graph.user_count >= app->max_users){ puts("User limit reached."); return; }
     char u[USERNAME_MAX], p[PASSWORD_MAX];
     printf("New username: "); if (!get_line(u,sizeof u)) return;
     if (!valid_name(u)){ puts("Invalid username."); return; }
-    if (bst_find(app->users_bst,u)){ puts("Username already exists."); return; }
+    if (app_user_find(app,u)){ puts("Username already exists."); return; }
     printf("Set password: "); if (!get_password(p,sizeof p)) return;
-    int ok=0; app->users_bst = bst_insert(app->users_bst,u,p,&ok);
+    int ok=0; app->users_bst = bst_insert(&app->users, app->users_bst,u,p,&ok);
     if (!ok){ puts("Insert failed."); return; }
+    if (app->ustore && !ustore_insert(app->ustore,u,p)) puts("Warning: user not saved to disk store.");
     if (!graph_add_user(&app->graph,u)){ puts("Graph add failed."); }
+    cdc_register(&app->cdc, u, p);
     puts("User created.");
 }
 
@@ -288,86 +3827,205 @@ void ui_login(App *app){
     char u[USERNAME_MAX], p[PASSWORD_MAX];
     printf("Username: "); if (!get_line(u,sizeof u)) return;
     printf("Password: "); if (!get_password(p,sizeof p)) return;
-    UserNode *n = bst_find(app->users_bst,u);
-    if (!n || strcmp(n->user.password,p)!=0){ puts("Invalid credentials."); return; }
+    UserNode *n = app_user_find(app,u);
+    if (!n || strcmp(user_cold(&app->users,n)->password,p)!=0){ puts("Invalid credentials."); return; }
+    if (app->current && app->current != n) pubsub_unsubscribe(&app->subs, cur_name(app));   /* switching users */
     app->current = n;
-    printf("Logged in as %s\n", n->user.username);
+    pubsub_subscribe(&app->subs, user_cold(&app->users,n)->username);
+    printf("Logged in as %s\n", user_cold(&app->users,n)->username);
 }
 
 void ui_logout(App *app){
     if (!app->current){ puts("Not logged in."); return; }
-    printf("Goodbye, %s\n", app->current->user.username);
+    printf("Goodbye, %s\n", cur_name(app));
+    pubsub_unsubscribe(&app->subs, cur_name(app));
     app->current=NULL;
 }
 
 void ui_create_post(App *app){
-    if (!session_required(app)) return;
+    if (!writable(app) || !session_required(app)) return;
     if (app->posts.size >= app->max_posts){ puts("Post limit reached."); return; }
     char text[CONTENT_MAX];
     printf("Content: "); if (!get_line(text,sizeof text)) return;
     if (!*text){ puts("Empty content."); return; }
     Post p; p.id = next_post_id();
-    strncpy(p.author, app->current->user.username, USERNAME_MAX-1); p.author[USERNAME_MAX-1]='\0';
+    strncpy(p.author, cur_name(app), USERNAME_MAX-1); p.author[USERNAME_MAX-1]='\0';
     strncpy(p.content, text, CONTENT_MAX-1); p.content[CONTENT_MAX-1]='\0';
     format_timestamp(p.timestamp, TIMESTAMP_MAX);
     if (posts_add(&app->posts,&p)) puts("Posted.");
     else puts("Failed to post.");
 }
 
-void ui_view_posts(App *app){ (void)app; posts_list_desc(&((App*)app)->posts); }
+/* Show a long listing one page at a time: fill() emits up to max lines
+ * into the output layer from its cursor and returns how many it wrote.
+ * Nothing beyond the current page is ever materialised. Without a
+ * terminal (piped or --batch input) it never prompts, since that would
+ * eat the next command. */
+void pager_run(int (*fill)(void *ctx, int max), void *ctx){
+    char buf[16];
+    int prompt = input_is_tty();
+    for (;;){
+        int n = fill(ctx, PAGER_PAGE);
+        if (n < PAGER_PAGE){ out_flush(); return; }
+        if (!prompt) continue;
+        out_printf("-- more (Enter = next page, q = quit) -- ");
+        out_flush();
+        if (!get_line(buf,sizeof buf) || buf[0]=='q' || buf[0]=='Q') return;
+    }
+}
+static int page_adj(void *ctx, int max){
+    AdjCursor *c = (AdjCursor*)ctx;
+    int n = 0;
+    const char *name;
+    for (; n < max && (name = graph_cursor_next(c)); n++) out_printf(" - %s\n", name);
+    return n;
+}
+typedef struct PostCursor { App *app; int below; } PostCursor;
+static int page_posts(void *ctx, int max){
+    PostCursor *pc = (PostCursor*)ctx;
+    Post page[PAGER_PAGE];
+    int n = app_posts_before(pc->app, pc->below, page, max < PAGER_PAGE ? max : PAGER_PAGE);
+    for (int i=0;i<n;i++)
+        out_printf(" #%d by %s at %s: %s\n", page[i].id, page[i].author, page[i].timestamp, page[i].content);
+    if (n) pc->below = page[n-1].id;
+    return n;
+}
+
+void ui_view_posts(App *app){
+    PostCursor pc = { app, INT_MAX };
+    Post first;
+    if (!app_posts_before(app, INT_MAX, &first, 1)){ puts("No posts yet."); return; }
+    out_puts("Posts (newest first):");
+    pager_run(page_posts, &pc);
+}
 
 void ui_follow(App *app){
-    if (!session_required(app)) return;
+    if (!writable(app) || !session_required(app)) return;
     char target[USERNAME_MAX];
     printf("Follow username: "); if (!get_line(target,sizeof target)) return;
-    if (!bst_find(app->users_bst,target)){ puts("User not found."); return; }
-    if (graph_add_edge(&app->graph, app->current->user.username, target)) {
-        app->current->user.following++;
-        UserNode *t=bst_find(app->users_bst,target); if (t) t->user.followers++;
-        printf("Now following %s\n", target);
-    } else puts("Follow failed (maybe already following).");
+    if (!app_user_find(app,target)){ puts("User not found."); return; }
+    Txn t; txn_begin(&t, app);
+    txn_follow(&t, cur_name(app), target);
+    if (txn_commit(&t) == TXN_OK) printf("Now following %s\n", target);
+    else puts("Follow failed (maybe already following).");
 }
 
 void ui_unfollow(App *app){
-    if (!session_required(app)) return;
+    if (!writable(app) || !session_required(app)) return;
     char target[USERNAME_MAX];
     printf("Unfollow username: "); if (!get_line(target,sizeof target)) return;
-    if (graph_remove_edge(&app->graph, app->current->user.username, target)) {
-        if (app->current->user.following>0) app->current->user.following--;
-        UserNode *t=bst_find(app->users_bst,target); if (t && t->user.followers>0) t->user.followers--;
-        printf("Unfollowed %s\n", target);
-    } else puts("Unfollow failed (maybe not following).");
+    Txn t; txn_begin(&t, app);
+    txn_unfollow(&t, cur_name(app), target);
+    if (txn_commit(&t) == TXN_OK) printf("Unfollowed %s\n", target);
+    else puts("Unfollow failed (maybe not following).");
+}
+
+/* Several names on one line, separated by spaces or commas. */
+static void follow_many(App *app, int follow){
+    if (!writable(app) || !session_required(app)) return;
+    char line[1024];
+    printf(follow ? "Follow usernames: " : "Unfollow usernames: ");
+    if (!get_line(line,sizeof line)) return;
+    const char *names[sizeof line/2];
+    int n = 0;
+    for (char *p=line; *p; ){
+        p += strspn(p," ,");
+        if (!*p) break;
+        char *q = p + strcspn(p," ,");
+        if (*q) *q++ = '\0';
+        if (valid_name(p)) names[n++] = p;
+        else printf("Skipping invalid name '%s'.\n", p);
+        p = q;
+    }
+    if (!n) return;
+    int k = app_follow_many(app, cur_name(app), names, n, follow);
+    printf(follow ? "Now following %d new of %d listed.\n" : "Unfollowed %d of %d listed.\n", k, n);
 }
+void ui_follow_many(App *app){ follow_many(app, 1); }
+void ui_unfollow_many(App *app){ follow_many(app, 0); }
 
+static void show_adj(App *app, int side){
+    const char *u = cur_name(app);
+    GraphUser *gu = graph_find(&app->graph, u);
+    if (!gu){ printf("User '%s' not found.\n", u); return; }
+    out_printf(side==GRAPH_FOLLOWING ? "%s follows:\n" : "%s is followed by:\n", u);
+    if (!graph_degree(gu, side)){ out_puts(" (none)"); out_flush(); return; }
+    AdjCursor c;
+    graph_cursor(&c, &app->graph, gu, side);
+    pager_run(page_adj, &c);
+}
 void ui_show_following(App *app){
     if (!session_required(app)) return;
-    graph_show_following(&app->graph, app->current->user.username);
+    show_adj(app, GRAPH_FOLLOWING);
 }
 void ui_show_followers(App *app){
     if (!session_required(app)) return;
-    graph_show_followers(&app->graph, app->current->user.username);
+    show_adj(app, GRAPH_FOLLOWERS);
+}
+void ui_show_mutual(App *app){
+    if (!session_required(app)) return;
+    const char *u = cur_name(app);
+    GraphUser *gu = graph_find(&app->graph, u);
+    if (!gu){ printf("User '%s' not found.\n", u); return; }
+    out_printf("%s and these users follow each other:\n", u);
+    if (!graph_mutual(&app->graph, gu, show_name, NULL)) out_puts(" (none)");
+    out_flush();
 }
 
-void ui_send_message(App *app){
+static int show_follower_since(void *ctx, const char *name, unsigned t){
+    (void)ctx;
+    char when[TIMESTAMP_MAX];
+    format_time(when, sizeof when, (time_t)t);
+    out_printf(" - %s (since %s)\n", name, when);
+    return 1;
+}
+void ui_new_followers(App *app){
     if (!session_required(app)) return;
+    const char *u = cur_name(app);
+    GraphUser *gu = graph_find(&app->graph, u);
+    if (!gu){ printf("User '%s' not found.\n", u); return; }
+    char buf[16];
+    printf("Days back (default 7): "); if (!get_line(buf,sizeof buf)) return;
+    long days = *buf ? strtol(buf, NULL, 10) : 7;
+    if (days < 0) days = 0;
+    if (days > 36500) days = 36500;
+    time_t now = time(NULL);
+    unsigned since = (long long)now > days*86400LL ? (unsigned)(now - (time_t)(days*86400)) : 0;
+    out_printf("New followers of %s in the last %ld days:\n", u, days);
+    if (!graph_followers_since(&app->graph, gu, since, show_follower_since, NULL)) out_puts(" (none)");
+    out_flush();
+}
+
+void ui_send_message(App *app){
+    if (!writable(app) || !session_required(app)) return;
     char to[USERNAME_MAX], text[CONTENT_MAX];
     printf("Send to: "); if (!get_line(to,sizeof to)) return;
-    if (!bst_find(app->users_bst,to)){ puts("Recipient not found."); return; }
+    if (!app_user_find(app,to)){ puts("Recipient not found."); return; }
     printf("Message: "); if (!get_line(text,sizeof text)) return;
-    Message m;
-    strncpy(m.from, app->current->user.username, USERNAME_MAX-1); m.from[USERNAME_MAX-1]='\0';
-    strncpy(m.to, to, USERNAME_MAX-1); m.to[USERNAME_MAX-1]='\0';
-    strncpy(m.content, text, CONTENT_MAX-1); m.content[CONTENT_MAX-1]='\0';
-    format_timestamp(m.timestamp, TIMESTAMP_MAX);
-    if (mq_enqueue(&app->mq,&m)) puts("Message queued.");
-    else puts("Queue full.");
+    Message local, *m = &local;
+    unsigned long long ticket = 0;
+    if (app->delivery && !(m = shmring_reserve(app->delivery, &ticket))){ puts("Delivery ring full."); return; }
+    /* with a delivery worker the Message is written straight into the shared ring */
+    strncpy(m->from, cur_name(app), USERNAME_MAX-1); m->from[USERNAME_MAX-1]='\0';
+    strncpy(m->to, to, USERNAME_MAX-1); m->to[USERNAME_MAX-1]='\0';
+    strncpy(m->content, text, CONTENT_MAX-1); m->content[CONTENT_MAX-1]='\0';
+    format_timestamp(m->timestamp, TIMESTAMP_MAX);
+    if (app->delivery){
+        cdc_message_handoff(&app->cdc, m);      /* before commit: the worker may reuse the slot */
+        shmring_commit(app->delivery, ticket); puts("Message handed to delivery worker.");
+    } else if (mq_enqueue(&app->mq,m)){
+        cdc_message(&app->cdc, CDC_MESSAGE, m);
+        puts("Message queued.");
+    } else puts("Queue full.");
 }
 
 void ui_process_message(App *app){
+    if (!writable(app)) return;
     Message m;
-    if (mq_dequeue(&app->mq,&m))
+    if (mq_dequeue(&app->mq,&m)){
+        cdc_message(&app->cdc, CDC_DELIVER, &m);
         printf("Delivered: %s -> %s | %s\n", m.from, m.to, m.content);
-    else puts("No messages to deliver.");
+    } else puts("No messages to deliver.");
 }
 
 void ui_show_messages(App *app){
@@ -375,6 +4033,35 @@ void ui_show_messages(App *app){
     mq_print(&app->mq);
 }
 
+void ui_new_posts(App *app){
+    if (!session_required(app)) return;
+    Subscriber *s = pubsub_find(&app->subs, cur_name(app));
+    int id, c=0;
+    while (s && pubsub_poll(s,&id)){
+        Post post, *p = &post;
+        if (!app_post_find(app,id,p)) continue;
+        if (!c) puts("New posts from people you follow:");
+        printf(" #%d by %s at %s: %s\n", p->id, p->author, p->timestamp, p->content);
+        c++;
+    }
+    if (!c) puts("No new posts.");
+    if (s && s->dropped){ printf(" (%u older notifications dropped)\n", s->dropped); s->dropped=0; }
+}
+
+/* Feed = newest posts by the user and the people they follow. The first
+ * page is rendered once (here or by app_feed_warm) and replayed from the
+ * cache until a post or a following change invalidates it. */
+void ui_view_feed(App *app){
+    if (!session_required(app)) return;
+    GraphUser *gu = graph_find(&app->graph, cur_name(app));
+    if (!gu){ puts("No feed."); return; }
+    if (gu->feed_valid) app->feed_hits++;
+    else { app->feed_misses++; app_feed_render(app, gu); }
+    out_puts("Your feed (newest first):");
+    out_write(gu->feed.data, gu->feed.len);
+    out_flush();
+}
+
 /* ====== Admin Functions ====== */
 void ui_admin_register(App *app){
     if (app->admin.is_registered){ puts("Admin already registered."); return; }
@@ -439,25 +4126,574 @@ void ui_admin_change_limits(App *app){
     puts("Limits updated.");
 }
 
+static void print_cache_stats(const char *label, RecCache *c){
+    unsigned long h, m;
+    rcache_stats(c,&h,&m);
+    printf("%s: %lu hits, %lu misses, hit rate %.1f%%\n", label, h, m,
+           h+m ? 100.0*(double)h/(double)(h+m) : 0.0);
+}
+
+void ui_admin_stats(App *app){
+    if (!app->current_admin){ puts("Admin access required."); return; }
+    printf("\nUsers: %d  Posts: %d  Queued messages: %d\n",
+           app->graph.user_count, app->posts.size, app->mq.count);
+    printf("Feed cache: %lu hits, %lu renders, %lu precomputed (%d users ranked)\n",
+           app->feed_hits, app->feed_misses, app->feed_warmed, app->nwarm);
+    if (app->mvcc.npins)
+        printf("Snapshots: %d pinned, %d versions logged (epoch %u)\n",
+               app->mvcc.npins, app->mvcc.n, app->mvcc.epoch);
+    printf("Transactions: %lu committed, %lu aborted\n", app->txn_commits, app->txn_aborts);
+    int nbits = 0; size_t bytes = 0;
+    for (const GraphUser *gu=app->graph.head; gu; gu=gu->next){
+        if (gu->following.bits){ nbits++; bytes += roar_bytes(gu->following.bits); }
+        if (gu->followers.bits){ nbits++; bytes += roar_bytes(gu->followers.bits); }
+    }
+    printf("Follow graph: %d users, %d names, %d bitmap sets (%zu bytes)\n",
+           app->graph.user_count, app->graph.nnames, nbits, bytes);
+    const Cdc *c = &app->cdc;
+    if (cdc_active(c))
+        printf("CDC: seq %llu, %lu records, %lu bytes sent, %d subscribers (%lu cut off), %d followers "
+               "(%lu dropped), log %zu bytes\n", c->seq, c->records, c->bytes_sent, c->nsubs, c->cut_off,
+               c->nfollowers, c->repl_dropped, c->wal_len);
+    if (app->ustore){
+        const UserStore *s = app->ustore;
+        unsigned long acc = s->hits + s->misses;
+        printf("User store: %u pages, buffer pool %d frames, hit rate %.1f%%, %lu reads, %lu writes\n",
+               s->npages, s->nframes, acc ? 100.0*(double)s->hits/(double)acc : 0.0, s->reads, s->writes);
+    }
+    if (app->lsm){
+        LsmStore *s = app->lsm;
+        pthread_mutex_lock(&s->lock);
+        long total = app->posts.size;
+        for (int i=0;i<s->nruns;i++) total += s->runs[i]->count;
+        printf("Post store: %ld posts (%d in memtable, %d runs), %lu flushes, %lu compactions, "
+               "%lu run reads, %lu bloom skips\n", total, app->posts.size, s->nruns,
+               s->flushes, s->compactions, s->run_reads, s->bloom_skips);
+        pthread_mutex_unlock(&s->lock);
+        print_cache_stats("Post cache", s->cache);
+    }
+    if (app->read_only){
+        const Replica *r = &app->replica;
+        printf("Replica: %s, applied seq %llu (%lu records), lag %lld ms\n",
+               r->fd >= 0 ? "connected" : "disconnected", r->applied_seq, r->applied, r->lag_ms);
+    }
+}
+
+void ui_admin_export(App *app){
+    if (!app->current_admin){ puts("Admin access required."); return; }
+    if (app->export && app->export->f){ printf("Export to %s still running.\n", app->export->path); return; }
+    if (app->ustore){ puts("Export is not available with --user-store: users on disk are outside the snapshot."); return; }
+    char path[CDC_PATH_MAX];
+    printf("Export file: "); if (!get_line(path,sizeof path) || !*path) return;
+    if (!app_export_start(app, path)){ printf("Could not start export to %s.\n", path); return; }
+    printf("Exporting snapshot at epoch %u (%d users); it continues between commands.\n",
+           app->export->snap.epoch, app->export->snap.nusers);
+}
+
+/* Print how many groups a vertex labelling has and its largest ones. */
+#define TOP_GROUPS 5
+static void print_groups(const Graph *g, const Csr *c, const int *label, const char *title){
+    int *size = (int*)calloc((size_t)c->n, sizeof *size);
+    if (!size){ puts("Out of memory."); return; }
+    int groups = 0;
+    for (int v=0; v<c->n; v++) groups += size[label[v]]++ == 0;
+    printf("%s: %d\n", title, groups);
+    for (int k=0; k<TOP_GROUPS && k<groups; k++){
+        int best = 0;
+        for (int v=1; v<c->n; v++) if (size[v] > size[best]) best = v;
+        if (size[best] < 2) break;
+        printf("  %d users:", size[best]);
+        int shown = 0;
+        for (int v=0; v<c->n && shown<5; v++)
+            if (label[v] == best){ printf(" %s", graph_name(g, c->orig[v])); shown++; }
+        puts(size[best] > shown ? " ..." : "");
+        size[best] = 0;
+    }
+    free(size);
+}
+/* Cluster structure of the follow graph, computed on a snapshot. */
+void ui_admin_analytics(App *app){
+    if (!app->current_admin){ puts("Admin access required."); return; }
+    Csr c, sym;
+    if (!csr_build(&c, &app->graph)){ puts("Out of memory."); return; }
+    int *comp = (int*)malloc(sizeof(int)*(size_t)(c.n ? c.n : 1));
+    int *label = (int*)malloc(sizeof(int)*(size_t)(c.n ? c.n : 1));
+    if (!comp || !label || !csr_symmetric(&c, &sym)){
+        puts("Out of memory."); free(comp); free(label); csr_free(&c); return;
+    }
+    int threads = analytics_threads();
+    printf("\nFollow graph: %d users, %ld follows (%d threads)\n", c.n, c.m, threads);
+    if (csr_components(&c, threads, comp) >= 0) print_groups(&app->graph, &c, comp, "Connected components");
+    int rounds = csr_label_propagation(&sym, threads, 20, label);
+    if (rounds >= 0){
+        printf("Label propagation: %d rounds\n", rounds);
+        print_groups(&app->graph, &c, label, "Communities");
+    }
+    long *tri = (long*)malloc(sizeof(long)*(size_t)(c.n ? c.n : 1));
+    long total = tri ? csr_triangles(&sym, threads, tri) : -1;
+    if (total >= 0){
+        double sum = 0; int eligible = 0;
+        for (int v=0; v<c.n; v++)
+            if (sym.off[v+1]-sym.off[v] >= 2){ sum += csr_clustering(&sym, tri, v); eligible++; }
+        printf("Triangles: %ld, average clustering coefficient %.3f\n", total, eligible ? sum/eligible : 0.0);
+        for (int k=0; k<TOP_GROUPS; k++){
+            int best = -1;
+            for (int v=0; v<c.n; v++) if (tri[v] > 0 && (best < 0 || tri[v] > tri[best])) best = v;
+            if (best < 0) break;
+            printf("  %-20s %ld triangles, %ld contacts, clustering %.3f\n", graph_name(&app->graph, c.orig[best]),
+                   tri[best], sym.off[best+1]-sym.off[best], csr_clustering(&sym, tri, best));
+            tri[best] = -tri[best];
+        }
+    }
+    free(tri);
+    int *core = comp;                           /* reuse: components are printed */
+    int top = csr_kcore(&sym, core);
+    if (top > 0){
+        int in_top = 0;
+        for (int v=0; v<c.n; v++) in_top += core[v] == top;
+        printf("K-core: innermost %d-core has %d users:", top, in_top);
+        for (int v=0, shown=0; v<c.n && shown<10; v++)
+            if (core[v] == top){ printf(" %s", graph_name(&app->graph, c.orig[v])); shown++; }
+        puts(in_top > 10 ? " ..." : "");
+    }
+    if (app_rank_feeds(app) >= 0)
+        printf("Feed precompute: %d users ranked by coreness, %d stale feeds rendered\n",
+               app->nwarm, app_feed_warm(app, app->nwarm));
+    free(comp); free(label);
+    csr_free(&sym); csr_free(&c);
+}
+
+/* ====== Benchmarks ====== */
+static double bench_now(void){
+    struct timespec ts; timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec/1e9;
+}
+static unsigned bench_rand(unsigned *st){ *st = *st*1103515245u + 12345u; return (*st >> 8); }
+
+/* Cold vs warm point lookups in the disk B+tree. "Cold" reopens the file
+ * with an empty buffer pool (and drops the OS cache where possible). */
+static void bench_btree(long n){
+    const char *path = "smm_bench_users.db";
+    remove(path);
+    UserStore *s = ustore_open(path, 1024);
+    if (!s){ puts("cannot create store"); return; }
+    char name[USERNAME_MAX];
+    unsigned st = 42;
+    double t0 = bench_now();
+    for (long i=0;i<n;i++){ snprintf(name,sizeof name,"user%08u",bench_rand(&st)%100000000u); ustore_insert(s,name,"pw"); }
+    double t1 = bench_now();
+    printf("insert: %ld users in %.3f s (%.0f/s), %u pages\n", n, t1-t0, (double)n/(t1-t0), s->npages);
+    ustore_close(s);
+
+    long q = n < 100000 ? n : 100000;
+    for (int pass=0; pass<2; pass++){
+#if defined(POSIX_FADV_DONTNEED)
+        if (pass==0){ int fd = open(path,O_RDONLY); if (fd>=0){ posix_fadvise(fd,0,0,POSIX_FADV_DONTNEED); close(fd); } }
+#endif
+        if (pass==0) s = ustore_open(path, (int)(n/BT_LEAF_MAX*2 + 64));
+        if (!s){ puts("cannot reopen store"); return; }
+        unsigned long h0=s->hits, m0=s->misses;
+        st = 42; long found = 0; User u;
+        t0 = bench_now();
+        for (long i=0;i<q;i++){ snprintf(name,sizeof name,"user%08u",bench_rand(&st)%100000000u); found += ustore_find(s,name,&u); }
+        t1 = bench_now();
+        unsigned long hits = s->hits-h0, acc = hits + s->misses-m0;
+        printf("%s lookups: %ld in %.3f s (%.0f/s), found %ld, pool hit rate %.1f%%\n",
+               pass ? "warm" : "cold", q, t1-t0, (double)q/(t1-t0), found, acc ? 100.0*(double)hits/(double)acc : 0.0);
+    }
+    ustore_close(s);
+    remove(path);
+}
+
+/* Listing N posts: one fprintf per line into a line-buffered stream (what
+ * a terminal gets) vs the buffered output layer, both into the null device. */
+static void bench_output(long n){
+#ifdef _WIN32
+    const char *null_dev = "NUL";
+#else
+    const char *null_dev = "/dev/null";
+#endif
+    Post *posts = (Post*)malloc(sizeof(Post)*(size_t)n);
+    FILE *f = fopen(null_dev, "w");
+    if (!posts || !f){ free(posts); if (f) fclose(f); puts("setup failed"); return; }
+    for (long i=0;i<n;i++){
+        posts[i].id = (int)i+1;
+        snprintf(posts[i].author, USERNAME_MAX, "user%ld", i%1000);
+        format_timestamp(posts[i].timestamp, TIMESTAMP_MAX);
+        snprintf(posts[i].content, CONTENT_MAX, "post number %ld with some typical text", i);
+    }
+    setvbuf(f, NULL, _IOLBF, BUFSIZ);
+    double t0 = bench_now();
+    fputs("Posts (newest first):\n", f);
+    for (long i=n-1;i>=0;--i)
+        fprintf(f, " #%d by %s at %s: %s\n", posts[i].id, posts[i].author, posts[i].timestamp, posts[i].content);
+    fflush(f);
+    double t1 = bench_now();
+    printf("per-line stdio:  %ld posts in %.3f s\n", n, t1-t0);
+    out_set_target(f);
+    PostArray pa = { posts, (int)n, (int)n, NULL, NULL };
+    t0 = bench_now();
+    posts_list_desc(&pa);
+    t1 = bench_now();
+    out_set_target(NULL);
+    printf("buffered output: %ld posts in %.3f s\n", n, t1-t0);
+    fclose(f);
+    free(posts);
+}
+
+/* strcmp vs the fixed-width compare on N random pairs of padded names of
+ * realistic length (5-15 chars, a quarter sharing a common prefix). */
+static void bench_names(long n){
+    enum { POOL = 4096 };
+    NameKey *pool = (NameKey*)malloc(sizeof(NameKey)*POOL);
+    unsigned *pairs = (unsigned*)malloc(sizeof(unsigned)*(size_t)n);
+    if (!pool || !pairs){ free(pool); free(pairs); puts("setup failed"); return; }
+    unsigned st = 7;
+    for (int i=0;i<POOL;i++){
+        char tmp[USERNAME_MAX];
+        int len = 5 + (int)(bench_rand(&st) % 11), j = 0;
+        if (bench_rand(&st) % 4 == 0){ memcpy(tmp, "the_", 4); j = 4; }
+        for (; j<len; j++) tmp[j] = (char)('a' + bench_rand(&st) % 26);
+        tmp[len] = '\0';
+        name_key(&pool[i], tmp);
+    }
+    for (long i=0;i<n;i++) pairs[i] = bench_rand(&st);
+
+    long sum[2] = {0,0}, eq[2] = {0,0}, disagree = 0;
+    double t[2];
+    for (int pass=0; pass<2; pass++){
+        double t0 = bench_now();
+        for (long i=0;i<n;i++){
+            const char *a = pool[pairs[i] % POOL].s, *b = pool[(pairs[i] >> 12) % POOL].s;
+            int c = pass ? name_cmp(a,b) : strcmp(a,b);
+            sum[pass] += c<0 ? -1 : c>0;
+            eq[pass] += pass ? name_eq(a,b) : strcmp(a,b)==0;
+        }
+        t[pass] = bench_now() - t0;
+    }
+    for (long i=0;i<n && i<100000;i++){
+        const char *a = pool[pairs[i] % POOL].s, *b = pool[(pairs[i] >> 12) % POOL].s;
+        int x = strcmp(a,b), y = name_cmp(a,b);
+        disagree += (x<0) != (y<0) || (x>0) != (y>0);
+    }
+    printf("strcmp:       %ld compares in %.3f s (%.1f ns each)\n", n, t[0], t[0]*1e9/(double)n);
+    printf("fixed-width:  %ld compares in %.3f s (%.1f ns each)\n", n, t[1], t[1]*1e9/(double)n);
+    printf("checksums %ld/%ld, equal %ld/%ld, %ld order mismatches\n", sum[0], sum[1], eq[0], eq[1], disagree);
+    free(pool); free(pairs);
+}
+
+/* BFS and PageRank on a synthetic follow graph of N users before and after
+ * renumbering. Users form communities of 64 with most follows inside the
+ * community, plus a few follows of popular accounts; ids are shuffled the
+ * way registration order scatters them. */
+static double csr_gap(const Csr *c){
+    double sum = 0;
+    for (int u=0; u<c->n; u++)
+        for (long i=c->off[u]; i<c->off[u+1]; i++) sum += abs(c->adj[i] - u);
+    return c->m ? sum/(double)c->m : 0;
+}
+static int bench_social_graph(long n, Csr *out){
+    enum { COMMUNITY = 64, LOCAL = 10, GLOBAL = 2 };
+    long m = n*(LOCAL+GLOBAL);
+    int *shuffle = (int*)malloc(sizeof(int)*(size_t)n);
+    int *src = (int*)malloc(sizeof(int)*(size_t)m), *dst = (int*)malloc(sizeof(int)*(size_t)m);
+    int ok = 0;
+    if (shuffle && src && dst){
+        unsigned st = 99;
+        for (long i=0;i<n;i++) shuffle[i] = (int)i;
+        for (long i=n-1;i>0;i--){ long j = (long)(bench_rand(&st) % (unsigned)(i+1)); int t=shuffle[i]; shuffle[i]=shuffle[j]; shuffle[j]=t; }
+        long e = 0;
+        for (long u=0;u<n;u++){
+            long base = u - u%COMMUNITY, size = n-base < COMMUNITY ? n-base : COMMUNITY;
+            for (int k=0;k<LOCAL;k++){ src[e] = shuffle[u]; dst[e++] = shuffle[base + (long)(bench_rand(&st) % (unsigned)size)]; }
+            for (int k=0;k<GLOBAL;k++){
+                double x = (double)(bench_rand(&st) % 1000000u) / 1e6;
+                src[e] = shuffle[u]; dst[e++] = shuffle[(long)(x*x*x*(double)n)];   /* skewed to popular users */
+            }
+        }
+        ok = csr_from_edges(out, (int)n, src, dst, m);
+    }
+    free(shuffle); free(src); free(dst);
+    if (ok) printf("graph: %ld users, %ld follows\n", n, out->m);
+    else puts("setup failed");
+    return ok;
+}
+static void bench_reorder(long n){
+    enum { SOURCES = 4, ITERS = 10 };
+    int *dist = (int*)malloc(sizeof(int)*(size_t)n);
+    double *rank = (double*)malloc(sizeof(double)*(size_t)n);
+    Csr base;
+    if (!dist || !rank || !bench_social_graph(n, &base)){ free(dist); free(rank); return; }
+    static const char *names[] = { "registration", "degree", "bfs" };
+    for (int how=-1; how<=CSR_ORDER_BFS; how++){
+        Csr c; int *perm = NULL;
+        double t0 = bench_now();
+        if (how < 0) c = base;
+        else if (!(perm = csr_order(&base, how)) || !csr_permute(&base, perm, &c)){ free(perm); puts("reorder failed"); break; }
+        double t1 = bench_now();
+        long reached = 0;
+        for (int s=0;s<SOURCES;s++){
+            int v = (int)((long)s*n/SOURCES);
+            reached += csr_bfs(&c, perm ? perm[v] : v, dist);
+        }
+        double t2 = bench_now();
+        csr_pagerank(&c, ITERS, 0.85, rank);
+        double t3 = bench_now();
+        printf("%-12s order %.3f s | edge gap %9.0f | %d BFS %.3f s (%ld reached) | PageRank x%d %.3f s (r0 %.3g)\n",
+               names[how+1], how < 0 ? 0.0 : t1-t0, csr_gap(&c), SOURCES, t2-t1, reached, ITERS, t3-t2,
+               rank[perm ? perm[0] : 0]);
+        if (how >= 0) csr_free(&c);
+        free(perm);
+    }
+    csr_free(&base);
+    free(dist); free(rank);
+}
+
+/* Components, label propagation, triangles and k-core on the synthetic graph with 1, 2, 4 ...
+ * threads up to the core count. */
+static void bench_analytics(long n){
+    Csr c, sym;
+    if (!bench_social_graph(n, &c)) return;
+    int *out = (int*)malloc(sizeof(int)*(size_t)n);
+    if (!out || !csr_symmetric(&c, &sym)){ puts("setup failed"); free(out); csr_free(&c); return; }
+    int maxt = analytics_threads();
+    for (int t=1;; t = t*2 < maxt ? t*2 : maxt){
+        double t0 = bench_now();
+        int ncomp = csr_components(&c, t, out);
+        double t1 = bench_now();
+        int rounds = csr_label_propagation(&sym, t, 20, out);
+        double t2 = bench_now();
+        int groups = 0;
+        char *seen = (char*)calloc((size_t)n, 1);
+        if (seen) for (long v=0; v<n; v++) if (!seen[out[v]]){ seen[out[v]] = 1; groups++; }
+        free(seen);
+        double t2b = bench_now();
+        long tri = csr_triangles(&sym, t, NULL);
+        double t3 = bench_now();
+        int top = csr_kcore(&sym, out);
+        double t4 = bench_now();
+        printf("%2d threads: components %.3f s (%d) | label propagation %.3f s (%d rounds, %d communities)"
+               " | triangles %.3f s (%ld) | k-core %.3f s (max %d)\n",
+               t, t1-t0, ncomp, t2-t1, rounds, groups, t3-t2b, tri, t4-t3, top);
+        if (t == maxt) break;
+    }
+    free(out); csr_free(&sym); csr_free(&c);
+}
+
+/* Cross-check components, triangles and k-core against brute force on
+ * random graphs of N users: disjoint blocks of mixed size and density
+ * (isolated users, sparse chains, near-cliques), with 1, 2, 4 ... threads
+ * up to at least CHECK_THREADS so the parallel paths run on any machine. */
+#define CHECK_THREADS 8
+static int check_graph(long n, unsigned seed, Csr *out){
+    long cap = 16, m = 0;
+    int *src = (int*)malloc(sizeof(int)*(size_t)cap), *dst = (int*)malloc(sizeof(int)*(size_t)cap);
+    unsigned st = seed;
+    for (long base=0; src && dst && base<n; ){
+        long size = 1 + (long)(bench_rand(&st) % 40u);
+        if (size > n-base) size = n-base;
+        unsigned density = bench_rand(&st) % 101u;          /* percent */
+        for (long u=base; u<base+size; u++)
+            for (long v=base; v<base+size; v++){
+                if (u == v || bench_rand(&st) % 100u >= density) continue;
+                if (m == cap){
+                    cap *= 2;
+                    int *ns = (int*)realloc(src, sizeof(int)*(size_t)cap), *nd = ns ? (int*)realloc(dst, sizeof(int)*(size_t)cap) : NULL;
+                    if (ns) src = ns;
+                    if (nd) dst = nd;
+                    if (!ns || !nd){ free(src); free(dst); return 0; }
+                }
+                src[m] = (int)u; dst[m] = (int)v; m++;
+            }
+        base += size;
+    }
+    int ok = src && dst && csr_from_edges(out, (int)n, src, dst, m);
+    free(src); free(dst);
+    return ok;
+}
+static int check_analytics(const Csr *c, const Csr *sym, int threads){
+    int n = c->n, bad = 0;
+    unsigned char *adj = (unsigned char*)calloc((size_t)n*(size_t)n, 1);
+    int *label = (int*)malloc(sizeof(int)*(size_t)n), *stack = (int*)malloc(sizeof(int)*(size_t)n);
+    int *out = (int*)malloc(sizeof(int)*(size_t)n), *deg = (int*)malloc(sizeof(int)*(size_t)n);
+    long *tri = (long*)calloc((size_t)n, sizeof *tri), *got = (long*)malloc(sizeof(long)*(size_t)n);
+    if (!adj || !label || !stack || !out || !deg || !tri || !got){ bad = -1; goto done; }
+    for (int u=0; u<n; u++)
+        for (long i=sym->off[u]; i<sym->off[u+1]; i++) adj[(size_t)u*n + sym->adj[i]] = 1;
+
+    /* components: flood fill from each unlabelled vertex in id order, so
+     * the label is the smallest id, as csr_components promises */
+    int ncomp = 0;
+    for (int v=0; v<n; v++) label[v] = -1;
+    for (int v=0; v<n; v++){
+        if (label[v] >= 0) continue;
+        int sp = 0; stack[sp++] = v; label[v] = v; ncomp++;
+        while (sp){
+            int u = stack[--sp];
+            for (long i=sym->off[u]; i<sym->off[u+1]; i++){
+                int w = sym->adj[i];
+                if (label[w] < 0){ label[w] = v; stack[sp++] = w; }
+            }
+        }
+    }
+    if (csr_components(c, threads, out) != ncomp) bad++;
+    for (int v=0; v<n; v++) if (out[v] != label[v]){ bad++; break; }
+
+    /* triangles: every u < v < w, closing edge looked up in the matrix */
+    long total = 0;
+    for (int u=0; u<n; u++)
+        for (long i=sym->off[u]; i<sym->off[u+1]; i++){
+            int v = sym->adj[i];
+            if (v <= u) continue;
+            for (long j=sym->off[v]; j<sym->off[v+1]; j++){
+                int w = sym->adj[j];
+                if (w > v && adj[(size_t)u*n + w]){ total++; tri[u]++; tri[v]++; tri[w]++; }
+            }
+        }
+    if (csr_triangles(sym, threads, got) != total) bad++;
+    for (int v=0; v<n; v++) if (got[v] != tri[v]){ bad++; break; }
+
+    /* k-core: for k = 1, 2 ... strip vertices of degree < k until none
+     * are left; a vertex stripped in round k has coreness k-1 */
+    int left = n, top = 0;
+    for (int v=0; v<n; v++){ deg[v] = (int)(sym->off[v+1]-sym->off[v]); label[v] = -1; }
+    for (int k=1; left; k++)
+        for (int changed=1; changed; ){
+            changed = 0;
+            for (int v=0; v<n; v++){
+                if (label[v] >= 0 || deg[v] >= k) continue;
+                label[v] = k-1; left--; changed = 1;
+                if (k-1 > top) top = k-1;
+                for (long i=sym->off[v]; i<sym->off[v+1]; i++) deg[sym->adj[i]]--;
+            }
+        }
+    if (csr_kcore(sym, out) != top) bad++;
+    for (int v=0; v<n; v++) if (out[v] != label[v]){ bad++; break; }
+done:
+    free(adj); free(label); free(stack); free(out); free(deg); free(tri); free(got);
+    return bad;
+}
+static void bench_check(long n){
+    enum { ROUNDS = 8 };
+    int maxt = analytics_threads() > CHECK_THREADS ? analytics_threads() : CHECK_THREADS, failed = 0;
+    for (int r=0; r<ROUNDS; r++){
+        Csr c, sym;
+        if (!check_graph(n, 1234u + (unsigned)r, &c)){ puts("setup failed"); return; }
+        if (!csr_symmetric(&c, &sym)){ puts("setup failed"); csr_free(&c); return; }
+        for (int t=1;; t = t*2 < maxt ? t*2 : maxt){
+            int bad = check_analytics(&c, &sym, t);
+            if (bad){ printf("round %d, %d threads: %s\n", r, t, bad < 0 ? "setup failed" : "MISMATCH"); failed++; }
+            if (t == maxt) break;
+        }
+        printf("round %d: %d users, %ld follows checked\n", r, c.n, c.m);
+        csr_free(&sym); csr_free(&c);
+    }
+    puts(failed ? "FAILED" : "OK: components, triangles and k-core match brute force");
+}
+
+/* Drive one hub's follow sets through the Roaring paths: list -> bitmap
+ * promotion past ADJ_BITMAP_AT, array -> bitmap chunks past
+ * ROAR_ARRAY_MAX, bitmap & bitmap intersection in graph_mutual, and the
+ * chunk's demotion back to an array as edges go. Each step is checked
+ * against a brute-force count over graph_has. */
+static int bench_count(void *ctx, const char *name){ (void)name; (*(long*)ctx)++; return 1; }
+static long bench_mutual_brute(const Graph *g, const GraphUser *hub, GraphUser **u, long n){
+    long k = 0;
+    for (long i=1;i<n;i++)
+        k += graph_has(g, hub, GRAPH_FOLLOWING, u[i]->username) && graph_has(g, hub, GRAPH_FOLLOWERS, u[i]->username);
+    return k;
+}
+static int bench_chunk_bitmap(const AdjSet *s){ return s->bits && s->bits->n && s->bits->chunks[0].bits; }
+static const char* bench_set_kind(const AdjSet *s){ return !s->bits ? "list" : bench_chunk_bitmap(s) ? "bitmap chunk" : "array chunk"; }
+static void bench_roaring(long n){
+    if (n < 8) n = 8;
+    if (n > 65536) n = 65536;                   /* keep every id in one chunk */
+    Graph g; graph_init(&g);
+    GraphUser **u = (GraphUser**)malloc(sizeof *u * (size_t)n);
+    char name[USERNAME_MAX];
+    for (long i=0; u && i<n; i++){
+        snprintf(name, sizeof name, "u%06ld", i);
+        if (!graph_add_user(&g, name) || !(u[i] = graph_find(&g, name))){ free(u); u = NULL; }
+    }
+    if (!u){ puts("setup failed"); graph_free(&g); return; }
+    GraphUser *hub = u[0];
+    int bad = 0;
+    double t0 = bench_now();
+    for (long i=1;i<n;i++){
+        if (i%4) graph_add_edge(&g, hub->username, u[i]->username, 0);
+        if (i%2==0) graph_add_edge(&g, u[i]->username, hub->username, 0);
+    }
+    double t1 = bench_now();
+    int promoted = hub->following.bits && hub->followers.bits;
+    printf("edges: %d following (%s), %d followers (%s) in %.3f s\n",
+           hub->following.count, bench_set_kind(&hub->following),
+           hub->followers.count, bench_set_kind(&hub->followers), t1-t0);
+    bad += hub->following.count > ADJ_BITMAP_AT && !promoted;
+
+    long got = 0, want;
+    t0 = bench_now();
+    graph_mutual(&g, hub, bench_count, &got);
+    t1 = bench_now();
+    want = bench_mutual_brute(&g, hub, u, n);
+    printf("mutual: %ld in %.6f s (brute force %ld)\n", got, t1-t0, want);
+    bad += got != want;
+
+    /* drop follows until the chunk fits an array again */
+    for (long i=1; i<n && hub->following.count > ROAR_ARRAY_MAX/2; i++)
+        graph_remove_edge(&g, hub->username, u[i]->username, 0);
+    got = 0;
+    t0 = bench_now();
+    graph_mutual(&g, hub, bench_count, &got);
+    t1 = bench_now();
+    want = bench_mutual_brute(&g, hub, u, n);
+    printf("after removals: %d following (%s); mutual %ld in %.6f s (brute force %ld)\n",
+           hub->following.count, bench_set_kind(&hub->following), got, t1-t0, want);
+    bad += got != want || (hub->following.count <= ROAR_ARRAY_MAX && bench_chunk_bitmap(&hub->following));
+    puts(bad ? "FAILED" : "OK");
+    free(u); graph_free(&g);
+}
+
+/* Entry point for `smm --bench NAME [N]`. Returns 0 for an unknown name. */
+int bench_run(const char *name, long n){
+    if (strcmp(name,"btree")==0){ bench_btree(n > 0 ? n : 200000); return 1; }
+    if (strcmp(name,"output")==0){ bench_output(n > 0 ? n : 1000000); return 1; }
+    if (strcmp(name,"names")==0){ bench_names(n > 0 ? n : 10000000); return 1; }
+    if (strcmp(name,"reorder")==0){ bench_reorder(n > 0 ? n : 1000000); return 1; }
+    if (strcmp(name,"analytics")==0){ bench_analytics(n > 0 ? n : 1000000); return 1; }
+    if (strcmp(name,"roaring")==0){ bench_roaring(n > 0 ? n : 10000); return 1; }
+    if (strcmp(name,"check")==0){ bench_check(n > 0 ? n : 5000); return 1; }
+    return 0;
+}
+
 /* ====== Menu ====== */
 void print_menu(void){
-    puts("\n--- SMM MVP ---");
-    puts("1. Register user");
-    puts("2. Login");
-    puts("3. Logout");
-    puts("4. Create post");
-    puts("5. View posts");
-    puts("6. Follow user");
-    puts("7. Unfollow user");
-    puts("8. Show following");
-    puts("9. Show followers");
-    puts("10. Send message (enqueue)");
-    puts("11. Process message (dequeue)");
-    puts("12. Show messages (queue)");
-    puts("13. Admin register");
-    puts("14. Admin login");
-    puts("15. Admin logout");
-    puts("16. Admin change limits");
-    puts("0. Exit");
-    printf("Choice: ");
+    out_puts("\n--- SMM MVP ---");
+    out_puts("1. Register user");
+    out_puts("2. Login");
+    out_puts("3. Logout");
+    out_puts("4. Create post");
+    out_puts("5. View posts");
+    out_puts("6. Follow user");
+    out_puts("7. Unfollow user");
+    out_puts("8. Show following");
+    out_puts("9. Show followers");
+    out_puts("10. Send message (enqueue)");
+    out_puts("11. Process message (dequeue)");
+    out_puts("12. Show messages (queue)");
+    out_puts("13. Admin register");
+    out_puts("14. Admin login");
+    out_puts("15. Admin logout");
+    out_puts("16. Admin change limits");
+    out_puts("17. New posts from followed users");
+    out_puts("18. Admin stats");
+    out_puts("19. View feed");
+    out_puts("20. Show mutual follows");
+    out_puts("21. Admin graph analytics");
+    out_puts("22. New followers since");
+    out_puts("23. Follow several users");
+    out_puts("24. Unfollow several users");
+    out_puts("25. Admin export snapshot");
+    out_puts("0. Exit");
+    out_printf("Choice: ");
+    out_flush();
 }
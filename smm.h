@@ -1,6 +1,12 @@
 #ifndef SMM_H
 #define SMM_H
 
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
 /* ====== DEMO LIMITS ====== */
 #define MAX_USERS    10
 #define MAX_POSTS    30
@@ -12,6 +18,15 @@
 #define ADMIN_USERNAME_MAX 32
 #define ADMIN_PASSWORD_MAX 32
 
+/* ====== NAMES ====== */
+/* Usernames held in memory are zero-padded to USERNAME_MAX and 16-byte
+ * aligned, so name_eq/name_cmp compare the whole field with vector loads
+ * instead of strcmp. Lookup keys are padded into a NameKey first. */
+#define NAME_ALIGN _Alignas(16)
+typedef struct NameKey {
+    NAME_ALIGN char s[USERNAME_MAX];
+} NameKey;
+
 /* ====== ADMIN ====== */
 typedef struct Admin {
     char username[ADMIN_USERNAME_MAX];
@@ -26,11 +41,130 @@ typedef struct User {
     int followers, following;
 } User;
 
+/* In memory a user is split by access pattern: lookups and degree queries
+ * only touch the 16-byte UserHot; credentials live in UserCold and
+ * are read on login or on a hash tie. Both arrays are indexed by user id.
+ * User above stays the on-disk / wire record and is assembled on demand. */
+typedef struct UserHot {
+    unsigned hash;              /* name hash, the primary tree key */
+    int followers, following;
+    unsigned mv_epoch;          /* last change logged for snapshots; see Mvcc */
+} UserHot;
+
+typedef struct UserCold {
+    NAME_ALIGN char username[USERNAME_MAX];
+    char password[PASSWORD_MAX];
+} UserCold;
+
+typedef struct UserTable {
+    UserHot *hot;
+    UserCold *cold;
+    int count, cap;
+} UserTable;
+
 typedef struct UserNode {
-    User user;
+    unsigned hash;              /* copy of hot[id].hash so descent stays in the node */
+    int id;
     struct UserNode *left, *right;
 } UserNode;
 
+/* ====== RECORD CACHE (sharded LRU) ====== */
+#define RC_SHARDS     8
+#define RC_POST_CAP   4096    /* Post records cached in front of the LSM runs */
+
+/* Fixed-size records keyed by a 64-bit key. Each shard has its own lock,
+ * hash chains and LRU list (head = most recent), so lookups from several
+ * threads rarely contend. Entries live in one slab per shard. */
+typedef struct RcShard {
+    pthread_mutex_t lock;
+    unsigned char *slab;
+    int *buckets;
+    int nbuckets, cap, used;
+    int head, tail, free_list;
+    unsigned long hits, misses;
+} RcShard;
+
+typedef struct RecCache {
+    size_t rec_size, entry_size;
+    RcShard shards[RC_SHARDS];
+} RecCache;
+
+/* ====== USERS ON DISK (B+tree) ====== */
+#define BT_PAGE      4096
+#define BT_LEAF_MAX  ((BT_PAGE - 16) / (int)sizeof(User))                      /* 56 */
+#define BT_INNER_MAX ((BT_PAGE - 16 - 4) / (USERNAME_MAX + 4))                 /* 113 */
+#define BP_DEFAULT_FRAMES 256
+
+/* One cached page. The clock hand clears `ref` and evicts the first
+ * unpinned frame it finds with ref already clear. */
+typedef struct BpFrame {
+    unsigned page;          /* 0 = empty: page 0 is the meta page and is never cached */
+    int pin, dirty, ref;
+    unsigned char *data;
+} BpFrame;
+
+typedef struct UserStore {
+    void *file;             /* FILE* */
+    unsigned root, npages;
+    BpFrame *frames;
+    int nframes, hand;
+    int *where;             /* page -> frame index or -1 */
+    unsigned where_cap;
+    unsigned long hits, misses, reads, writes;
+} UserStore;
+
+/* ====== BUFFERED INPUT ====== */
+#define LR_BUF 65536
+
+/* Reads big blocks with read(2) and hands out lines in place: the view
+ * returned by lr_next is NUL-terminated inside the buffer and stays valid
+ * until the next call. The buffer grows for lines longer than itself. */
+typedef struct LineReader {
+    int fd;
+    char *buf;
+    size_t start, end, cap;
+    int eof;
+} LineReader;
+
+/* ====== STRING BUFFER ====== */
+typedef struct StrBuf {
+    char *data;
+    size_t len, cap;
+} StrBuf;
+
+/* ====== BUFFERED OUTPUT ====== */
+#define OUT_FLUSH_AT 65536   /* pending bytes that force an early flush */
+
+/* ====== TRACING ====== */
+/* TRACE_SPAN("name") at the top of a block times it until the block
+ * exits and, when tracing is on, records a complete event in the calling
+ * thread's ring (oldest events are overwritten). trace_dump writes all
+ * rings as Chrome trace JSON (chrome://tracing, Perfetto). With tracing
+ * off a span costs one relaxed load and two branches. */
+#define TRACE_RING_EVENTS 8192
+typedef struct TraceEvent {
+    const char *name;           /* string literal */
+    unsigned long long ts, dur; /* ns */
+} TraceEvent;
+typedef struct TraceRing {
+    TraceEvent ev[TRACE_RING_EVENTS];
+    atomic_ulong head;          /* events ever written; single writer */
+    int tid;
+    struct TraceRing *next;
+} TraceRing;
+typedef struct TraceSpan { const char *name; unsigned long long t0; } TraceSpan;
+
+extern atomic_int trace_on;
+unsigned long long trace_now(void);
+void trace_record(const TraceSpan *s);
+static inline void trace_end(TraceSpan *s){ if (s->t0) trace_record(s); }
+#if defined(__GNUC__)
+#define TRACE_SPAN(nm) __attribute__((cleanup(trace_end))) TraceSpan trace_span_ = \
+    { (nm), atomic_load_explicit(&trace_on, memory_order_relaxed) ? trace_now() : 0 }
+#else
+#define TRACE_SPAN(nm) ((void)0)    /* needs scope-exit cleanup */
+#endif
+
 /* ====== POSTS ====== */
 typedef struct Post {
     int id;
@@ -42,8 +176,50 @@ typedef struct Post {
 typedef struct PostArray {
     Post *data;
     int size, cap;
+    /* called after every successful posts_add (publish, invalidate, ...) */
+    void (*on_add)(void *ctx, const Post *p);
+    void *on_add_ctx;
 } PostArray;
 
+/* ====== POSTS ON DISK (LSM) ====== */
+#define LSM_MAX_RUNS     64
+#define LSM_COMPACT_AT   4     /* same-tier runs merged together by the compactor */
+#define LSM_FENCE_STRIDE 64    /* posts per indexed block inside a run */
+#define LSM_BLOOM_BITS   10    /* bloom bits per post */
+#define LSM_BLOOM_K      7
+#define LSM_PATH_MAX     256
+
+/* Immutable sorted run: file = LsmRunHdr + Post[count] ordered by id.
+ * Only the bloom filter and every LSM_FENCE_STRIDE-th id stay in memory. */
+typedef struct LsmRunHdr {
+    unsigned magic, count;
+    int min_id, max_id;
+} LsmRunHdr;
+
+typedef struct LsmRun {
+    unsigned long long file_no;
+    int count, min_id, max_id;
+    unsigned char *bloom;
+    unsigned bloom_bits;
+    int *fences;
+} LsmRun;
+
+/* The App's PostArray is the memtable; lsm_flush turns it into a run. */
+typedef struct LsmStore {
+    char dir[LSM_PATH_MAX];
+    LsmRun *runs[LSM_MAX_RUNS];   /* oldest first */
+    int nruns;
+    unsigned long long next_file;
+    int memtable_max;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t compactor;
+    int stop;
+    int stalled;                  /* last compaction failed; wait for the next flush */
+    unsigned long flushes, compactions, bloom_skips, run_reads;
+    RecCache *cache;              /* hot Post records from the runs, keyed by id */
+} LsmStore;
+
 /* ====== MESSAGE QUEUE ====== */
 typedef struct Message {
     char from[USERNAME_MAX];
@@ -57,31 +233,342 @@ typedef struct MessageQueue {
     int head, tail, count;
 } MessageQueue;
 
+/* ====== ROARING BITMAP ====== */
+/* Set of 32-bit ids split by the high 16 bits into chunks. A chunk is a
+ * sorted array of low halves up to ROAR_ARRAY_MAX members and a 8 KiB
+ * bitmap beyond that, so sparse and dense ranges both stay compact. */
+#define ROAR_ARRAY_MAX 4096
+#define ROAR_WORDS     1024          /* 65536 bits */
+
+typedef struct RoarChunk {
+    unsigned short key;              /* high 16 bits */
+    int card;
+    int cap;                         /* array capacity */
+    unsigned short *array;           /* sorted, when bits == NULL */
+    unsigned long long *bits;
+} RoarChunk;
+
+typedef struct Roaring {
+    RoarChunk *chunks;               /* sorted by key */
+    int n, cap;
+} Roaring;
+
 /* ====== FOLLOW GRAPH ====== */
+/* Follow sets start as linked lists; past ADJ_BITMAP_AT members they are
+ * moved into a Roaring bitmap of vertex ids and stay there. Vertex ids
+ * come from the graph's name table, which also covers names owned by
+ * other shards. */
+#define ADJ_BITMAP_AT 64
+
 typedef struct AdjNode {
-    char username[USERNAME_MAX];
+    NAME_ALIGN char username[USERNAME_MAX];
     struct AdjNode *next;
 } AdjNode;
 
+enum { GRAPH_FOLLOWING, GRAPH_FOLLOWERS };   /* side of an edge */
+
+typedef struct AdjSet {
+    AdjNode *list;
+    Roaring *bits;                   /* replaces list once promoted */
+    int count;
+} AdjSet;
+
+/* Who followed a user and when: append-only and ordered by time, with an
+ * unfollow appended as a tombstone rather than erasing the follow. When
+ * the log fills up while at least half of it is superseded (tombstones and
+ * the follows they cancel), it is compacted instead of grown. */
+typedef struct FollowEvent {
+    unsigned t;                      /* seconds since the epoch */
+    int who;                         /* follower's name id; ~id = unfollow */
+} FollowEvent;
+
+typedef struct FollowLog {
+    FollowEvent *ev;
+    int n, cap;
+} FollowLog;
+
+/* Resumable walk over one AdjSet, for paged listings. */
+typedef struct AdjCursor {
+    const struct Graph *g;
+    const AdjSet *set;
+    const AdjNode *node;
+    unsigned next_id;
+    int done;
+} AdjCursor;
+
 typedef struct GraphUser {
-    char username[USERNAME_MAX];
-    AdjNode *following;
-    AdjNode *followers;
+    NAME_ALIGN char username[USERNAME_MAX];
+    int id;                     /* vertex id in Graph.names */
+    AdjSet following;
+    AdjSet followers;
+    FollowLog follow_log;       /* followers over time */
+    StrBuf feed;                /* rendered first feed page */
+    int feed_valid;             /* cleared by new posts / following changes */
+    unsigned mv_epoch;          /* last following change logged for snapshots */
     struct GraphUser *next;
 } GraphUser;
 
 typedef struct Graph {
     GraphUser *head;
     int user_count;
+    NameKey *names;                  /* vertex id -> name */
+    int *slots;                      /* open-addressing index into names, -1 = free */
+    int nnames, names_cap, slots_cap;
 } Graph;
 
+/* ====== GRAPH ANALYTICS ====== */
+/* Compressed sparse row snapshot of the follow graph: the out-neighbours
+ * of vertex v are adj[off[v] .. off[v+1]), sorted and de-duplicated.
+ * orig maps a snapshot vertex back to its Graph name id, so a snapshot
+ * can be renumbered for locality without losing names. */
+typedef struct Csr {
+    int n;
+    long m;
+    long *off;
+    int *adj;
+    int *orig;
+} Csr;
+
+enum { CSR_ORDER_DEGREE, CSR_ORDER_BFS };
+
+/* ====== PUB/SUB (new posts from followed users) ====== */
+#define SUB_QUEUE_CAP 64   /* post ids per subscriber, power of two */
+
+/* Single-producer/single-consumer ring of post ids: the publisher only
+ * advances tail, the subscribed session only advances head. */
+typedef struct SubQueue {
+    _Atomic unsigned head, tail;
+    int ids[SUB_QUEUE_CAP];
+} SubQueue;
+
+typedef struct Subscriber {
+    char username[USERNAME_MAX];
+    SubQueue q;
+    unsigned dropped;          /* publishes lost because the ring was full */
+    struct Subscriber *next;
+} Subscriber;
+
+typedef struct PubSub {
+    Subscriber *head;
+    int count;
+} PubSub;
+
+/* ====== CHANGE DATA CAPTURE ====== */
+#define CDC_MAX_SUBSCRIBERS 8
+#define CDC_BUF_MAX   65536  /* pending bytes per subscriber before it is cut off */
+#define CDC_PATH_MAX  108
+
+/* Mutation types carried on the stream. */
+enum { CDC_REGISTER=1, CDC_FOLLOW, CDC_UNFOLLOW, CDC_POST, CDC_MESSAGE, CDC_DELIVER };
+
+/* Wire format, all integers little-endian:
+ *   u32 body_len | u8 type | u64 seq | u64 time_ms | fields...
+ * Strings are u16 length + bytes (no terminator); post ids are u32.
+ *   REGISTER:                 str user, str password (empty on the
+ *                             subscriber stream; only the replication
+ *                             log carries it)
+ *   FOLLOW/UNFOLLOW:          str from, str to, u32 follow time (unix s)
+ *   POST:                     u32 id, str author, str timestamp, str content
+ *   MESSAGE/DELIVER:          str from, str to, str timestamp, str content */
+typedef struct CdcSub {
+    int fd;
+    unsigned char *buf;
+    int len;
+} CdcSub;
+
+/* A new replication follower is first sent a snapshot of the current
+ * state as ordinary records (all stamped with the current seq), then the
+ * log from the point it joined. The log keeps only what some follower has
+ * not been sent yet; a follower more than REPL_WAL_MAX behind is dropped
+ * and has to reconnect for a fresh snapshot. */
+#define REPL_MAX_FOLLOWERS 4
+#define REPL_WAL_MAX (16u<<20)
+typedef struct ReplFollower {
+    int fd;
+    unsigned long long off;     /* absolute log offset sent so far */
+    unsigned char *sync;        /* snapshot still to send */
+    size_t sync_len, sync_off, sync_cap;
+} ReplFollower;
+
+typedef struct Cdc {
+    int listen_fd;              /* -1 when the stream is disabled */
+    char path[CDC_PATH_MAX];
+    unsigned long long seq;     /* sequence number of the last record */
+    CdcSub subs[CDC_MAX_SUBSCRIBERS];
+    int nsubs;
+    unsigned long records, bytes_sent, cut_off;
+    /* leader side of replication: every record is kept in the log (WAL) */
+    int repl_fd;                /* -1 when not serving followers */
+    char repl_path[CDC_PATH_MAX];
+    unsigned char *wal;         /* log bytes from absolute offset wal_base */
+    size_t wal_len, wal_cap;
+    unsigned long long wal_base;
+    ReplFollower followers[REPL_MAX_FOLLOWERS];
+    int nfollowers;
+    unsigned long repl_dropped;
+    ReplFollower *syncing;      /* records go only to this follower's snapshot */
+    void (*snapshot)(void *ctx);   /* emits the whole state; set by the App */
+    void *snapshot_ctx;
+} Cdc;
+
+/* One decoded record; which fields are set depends on type (see above). */
+typedef struct CdcEvent {
+    int type;
+    unsigned long long seq;
+    long long time_ms;
+    int post_id;
+    unsigned follow_time;
+    char a[USERNAME_MAX], b[USERNAME_MAX];
+    char timestamp[TIMESTAMP_MAX];
+    char content[CONTENT_MAX];
+} CdcEvent;
+
+/* ====== REPLICATION (follower side) ====== */
+#define REPL_BUF 8192
+
+typedef struct Replica {
+    int fd;                          /* -1 when not following a leader */
+    unsigned char buf[REPL_BUF];
+    int len;
+    unsigned long long applied_seq;  /* last leader seq applied locally */
+    unsigned long applied;
+    long long lag_ms;                /* leader commit -> local apply, last record */
+} Replica;
+
+/* ====== SHARDING ====== */
+#define SHARD_MAX 16
+
+/* ====== SHARED-MEMORY MESSAGE RING ====== */
+#define SHM_RING_MAGIC 0x524d4d53u   /* "SMMR" */
+#define SHM_RING_CAP   1024          /* slots, power of two */
+
+/* Bounded MPSC ring (Vyukov sequence per slot) living in a POSIX shared
+ * memory object. Producers claim a slot by ticket, write the Message in
+ * place and publish it; the consumer reads it in place. The futex word is
+ * bumped on every publish so an idle consumer can sleep on it. */
+typedef struct ShmSlot {
+    _Atomic unsigned long long seq;
+    Message msg;
+} ShmSlot;
+
+typedef struct ShmRingHdr {
+    unsigned magic, cap;
+    _Atomic unsigned long long head;   /* consumer position */
+    _Atomic unsigned long long tail;   /* next producer ticket */
+    _Atomic unsigned futex;
+    _Atomic unsigned sleepers;
+    ShmSlot slots[];
+} ShmRingHdr;
+
+typedef struct ShmRing {
+    ShmRingHdr *hdr;
+    size_t size;
+    char name[64];
+    int owner;                         /* creator unlinks the object on close */
+} ShmRing;
+
+/* ====== STATE HANDOFF ====== */
+#define HANDOFF_MAGIC   0x464f4853u   /* "SHOF" */
+#define HANDOFF_VERSION 2
+
+/* Flat image of an App in a named shared-memory object. Sections are
+ * addressed by byte offsets from the start of the region, never by
+ * pointers, so any process can map it at any address.
+ *   users:  User[nusers] in BST preorder (re-inserting keeps the tree shape)
+ *   gusers: HandoffVertex[nvertices] in Graph list order
+ *   names:  char[USERNAME_MAX] adjacency entries referenced by the vertices
+ *   log:    HandoffFollow entries of each vertex's follow log
+ *   posts:  Post[nposts], messages: Message[nmsgs] front..back */
+typedef struct HandoffVertex {
+    char username[USERNAME_MAX];
+    int nfollowing, nfollowers, nlog;
+    unsigned long long following_off, followers_off, log_off;
+} HandoffVertex;
+
+typedef struct HandoffFollow {
+    unsigned t;
+    int follow;
+    char name[USERNAME_MAX];
+} HandoffFollow;
+
+typedef struct HandoffHdr {
+    unsigned magic, version;
+    unsigned long long size;
+    int nusers, nvertices, nposts, nmsgs;
+    unsigned long long users_off, vertices_off, posts_off, msgs_off;
+    Admin admin;
+    int max_users, max_posts, max_messages;
+} HandoffHdr;
+
+/* ====== PAGER ====== */
+#define PAGER_PAGE 20
+
+/* ====== FEED ====== */
+#define FEED_PAGE_POSTS 50
+#define FEED_WARM_PER_TURN 4   /* stale feeds re-rendered between commands */
+#define FEED_RERANK_EDGES 16   /* follow changes before the warm order is rebuilt */
+
+/* ====== SNAPSHOTS (MVCC) ====== */
+/* While a snapshot is pinned, writers log the before-image of each user
+ * record and follow edge they change, stamped with a rising epoch. A
+ * reader uses the live value unless it changed after the snapshot's
+ * epoch, in which case the first logged change past that epoch holds the
+ * value it had. Users and posts are append-only, so for them the
+ * snapshot is just a bound. */
+#define SNAP_MAX_PINS 8
+#define EXPORT_PER_TURN 256     /* rows an export writes between commands */
+enum { MV_USER, MV_EDGE };
+typedef struct MvEntry {
+    unsigned epoch;
+    int kind;
+    int a, b;                   /* MV_USER: user slot; MV_EDGE: name ids from -> to */
+    int followers, following;   /* MV_USER before-image; MV_EDGE: following = edge existed */
+} MvEntry;
+typedef struct Mvcc {
+    unsigned epoch;
+    MvEntry *log;
+    int n, cap;
+    unsigned pins[SNAP_MAX_PINS];
+    int npins;
+} Mvcc;
+typedef struct Snapshot {
+    unsigned epoch;
+    int nusers;                 /* UserTable slots that existed */
+    int post_hi;                /* posts with id < post_hi */
+} Snapshot;
+/* A snapshot export written a slice at a time between commands. */
+typedef struct Export {
+    FILE *f;
+    char path[CDC_PATH_MAX];
+    Snapshot snap;
+    int phase;                  /* users, follows, posts */
+    int user, below;
+    GraphUser *gu;
+    long users, edges, posts;
+} Export;
+
 /* ====== APP ====== */
 typedef struct App {
+    UserTable users;
     UserNode *users_bst;
     UserNode *current;
     PostArray posts;
     MessageQueue mq;
     Graph graph;
+    PubSub subs;
+    Cdc cdc;
+    Replica replica;
+    int read_only;              /* set on replication followers */
+    ShmRing *delivery;          /* hand messages to a delivery worker instead of mq */
+    UserStore *ustore;          /* optional disk-backed user records */
+    LsmStore *lsm;              /* optional disk-backed posts (memtable = posts) */
+    unsigned long feed_hits, feed_misses, feed_warmed;
+    unsigned long txn_commits, txn_aborts;
+    Mvcc mvcc;
+    Export *export;             /* running snapshot export, if any */
+    GraphUser **warm;           /* feed precompute order, densest core first */
+    int nwarm;
+    unsigned long warm_edges;   /* follow changes since the last ranking */
     Admin admin;
     Admin *current_admin;
     int max_users;
@@ -89,35 +576,214 @@ typedef struct App {
     int max_messages;
 } App;
 
+/* ====== TRANSACTIONS ====== */
+/* A Txn queues follow/unfollow ops; commit checks every op against the
+ * current graph (earlier ops' effects included) and applies them only if
+ * all are valid. All writers run on the single app loop thread, so
+ * nothing can change between check and apply and no commit lock or
+ * version check is needed; an apply can then only fail on allocation,
+ * which stops the commit and is reported as TXN_FAILED. */
+#define TXN_MAX_OPS 16
+enum { TXN_FOLLOW, TXN_UNFOLLOW };
+enum { TXN_FAILED = 0, TXN_OK = 1 };
+typedef struct TxnOp { int type; char a[USERNAME_MAX], b[USERNAME_MAX]; } TxnOp;
+typedef struct Txn {
+    App *app;
+    TxnOp ops[TXN_MAX_OPS];
+    int nops;
+    int failed;                 /* a queued op was invalid; commit aborts */
+} Txn;
+
 /* ====== Function Prototypes ====== */
+void sb_init(StrBuf *sb);
+int  trace_open(const char *path);
+int  trace_dump(const char *path);
+int  sb_printf(StrBuf *sb, const char *fmt, ...);
+int  sb_vprintf(StrBuf *sb, const char *fmt, va_list ap);
+int  sb_append(StrBuf *sb, const char *buf, size_t n);
+void sb_free(StrBuf *sb);
+
+void out_printf(const char *fmt, ...);
+void out_puts(const char *s);
+void out_write(const char *buf, size_t n);
+void out_flush(void);
+void out_set_target(FILE *f);
+
+int  lr_init(LineReader *r, int fd);
+int  lr_next(LineReader *r, char **line, size_t *len);
+void lr_free(LineReader *r);
+LineReader* input_reader(void);
+int  input_open(const char *path);
+
+void name_key(NameKey *k, const char *s);
+int  name_eq(const char *a, const char *b);
+int  name_cmp(const char *a, const char *b);
+
 int  get_line(char *buf, int n);
 int  get_password(char *buf, int n);
 void format_timestamp(char *buf, int n);
+void format_time(char *buf, int n, time_t when);
 int  next_post_id(void);
+void next_post_id_reset(int next);
 
 void posts_init(PostArray *pa, int initial_cap);
 void posts_free(PostArray *pa);
 int  posts_add(PostArray *pa, const Post *p);
+const Post* posts_find(const PostArray *pa, int id);
 void posts_list_desc(const PostArray *pa);
 
+LsmStore* lsm_open(const char *dir);
+int  lsm_flush(LsmStore *s, PostArray *mem);
+int  lsm_get(LsmStore *s, int id, Post *out);
+int  lsm_max_id(LsmStore *s);
+void lsm_foreach_desc(LsmStore *s, const PostArray *mem, int (*fn)(void *ctx, const Post *p), void *ctx);
+int  lsm_before(LsmStore *s, int below_id, Post *out, int max);
+void lsm_close(LsmStore *s, PostArray *mem);
+
 void mq_init(MessageQueue *q);
 int  mq_enqueue(MessageQueue *q, const Message *m);
 int  mq_dequeue(MessageQueue *q, Message *out);
 void mq_print(const MessageQueue *q);
 
-UserNode* bst_insert(UserNode *root, const char *username, const char *password, int *ok);
-UserNode* bst_find(UserNode *root, const char *username);
+void      users_init(UserTable *t);
+void      users_free(UserTable *t);
+void      users_get(const UserTable *t, int id, User *out);
+UserHot*  user_hot(const UserTable *t, const UserNode *n);
+UserCold* user_cold(const UserTable *t, const UserNode *n);
+UserNode* bst_insert(UserTable *t, UserNode *root, const char *username, const char *password, int *ok);
+UserNode* bst_find(const UserTable *t, const UserNode *root, const char *username);
 void      bst_free(UserNode *root);
 
+RecCache* rcache_new(int capacity, size_t rec_size);
+int       rcache_get(RecCache *c, unsigned long long key, void *out);
+void      rcache_put(RecCache *c, unsigned long long key, const void *rec);
+void      rcache_stats(RecCache *c, unsigned long *hits, unsigned long *misses);
+void      rcache_free(RecCache *c);
+
+UserStore* ustore_open(const char *path, int frames);
+int        ustore_find(UserStore *s, const char *username, User *out);
+int        ustore_insert(UserStore *s, const char *username, const char *password);
+int        ustore_update(UserStore *s, const User *u);
+int        ustore_delete(UserStore *s, const char *username);
+void       ustore_close(UserStore *s);
+
+void   roar_init(Roaring *r);
+void   roar_free(Roaring *r);
+int    roar_add(Roaring *r, unsigned v);
+int    roar_remove(Roaring *r, unsigned v);
+int    roar_contains(const Roaring *r, unsigned v);
+int    roar_next(const Roaring *r, unsigned from, unsigned *out);
+long   roar_card(const Roaring *r);
+void   roar_foreach(const Roaring *r, int (*fn)(void *ctx, unsigned v), void *ctx);
+int    roar_and(const Roaring *a, const Roaring *b, Roaring *out);
+size_t roar_bytes(const Roaring *r);
+
 void       graph_init(Graph *g);
+int        graph_intern(Graph *g, const char *name);
+int        graph_name_id(const Graph *g, const char *name);
+const char* graph_name(const Graph *g, int id);
+AdjSet*    graph_adj(GraphUser *gu, int side);
+int        graph_degree(const GraphUser *gu, int side);
+int        graph_has(const Graph *g, const GraphUser *gu, int side, const char *name);
+void       graph_foreach(const Graph *g, const GraphUser *gu, int side,
+                         int (*fn)(void *ctx, const char *name), void *ctx);
+int        graph_mutual(const Graph *g, const GraphUser *gu,
+                        int (*fn)(void *ctx, const char *name), void *ctx);
+void       graph_log_append(Graph *g, GraphUser *gu, const char *who, unsigned t, int follow);
+int        graph_followers_since(const Graph *g, const GraphUser *gu, unsigned since,
+                                 int (*fn)(void *ctx, const char *name, unsigned t), void *ctx);
+void       graph_cursor(AdjCursor *c, const Graph *g, const GraphUser *gu, int side);
+const char* graph_cursor_next(AdjCursor *c);
 GraphUser* graph_find(Graph *g, const char *username);
 int        graph_add_user(Graph *g, const char *username);
-int        graph_add_edge(Graph *g, const char *from, const char *to);
-int        graph_remove_edge(Graph *g, const char *from, const char *to);
-void       graph_show_following(Graph *g, const char *u);
-void       graph_show_followers(Graph *g, const char *u);
+int        graph_add_edge(Graph *g, const char *from, const char *to, unsigned when);
+int        graph_remove_edge(Graph *g, const char *from, const char *to, unsigned when);
+int        graph_edges_many(Graph *g, const char *from, const char *const *to, int n, int follow, unsigned when, unsigned char *changed);
+int        graph_add_half_edge(Graph *g, const char *owner, const char *other, int side);
+int        graph_remove_half_edge(Graph *g, const char *owner, const char *other, int side);
 void       graph_free(Graph *g);
 
+int   csr_from_edges(Csr *c, int n, const int *src, const int *dst, long m);
+int   csr_build(Csr *c, const Graph *g);
+int*  csr_order(const Csr *c, int how);
+int   csr_permute(const Csr *in, const int *perm, Csr *out);
+int   csr_bfs(const Csr *c, int src, int *dist);
+void  csr_pagerank(const Csr *c, int iters, double damping, double *rank);
+int   csr_symmetric(const Csr *c, Csr *out);
+int   csr_components(const Csr *c, int threads, int *comp);
+int   csr_label_propagation(const Csr *sym, int threads, int max_iters, int *label);
+long  csr_triangles(const Csr *sym, int threads, long *tri);
+double csr_clustering(const Csr *sym, const long *tri, int v);
+int   csr_kcore(const Csr *sym, int *core);
+int   analytics_threads(void);
+void  csr_free(Csr *c);
+
+void        pubsub_init(PubSub *ps);
+Subscriber* pubsub_find(PubSub *ps, const char *username);
+Subscriber* pubsub_subscribe(PubSub *ps, const char *username);
+void        pubsub_unsubscribe(PubSub *ps, const char *username);
+int         pubsub_publish(PubSub *ps, Graph *g, const Post *p);
+int         pubsub_poll(Subscriber *s, int *post_id);
+void        pubsub_free(PubSub *ps);
+
+void cdc_init(Cdc *c);
+int  cdc_open(Cdc *c, const char *path);
+void cdc_follow(Cdc *c, int type, const char *from, const char *to, unsigned when);
+void cdc_register(Cdc *c, const char *user, const char *password);
+void app_publish_state(App *app);
+void cdc_post(Cdc *c, const Post *p);
+void cdc_message(Cdc *c, int type, const Message *m);
+void cdc_message_handoff(Cdc *c, const Message *m);
+void cdc_flush(Cdc *c);
+void cdc_close(Cdc *c);
+int  cdc_decode(const unsigned char *buf, int len, CdcEvent *ev);
+
+int  repl_listen(Cdc *c, const char *path);
+int  replica_connect(App *app, const char *path);
+int  replica_poll(App *app);
+void replica_close(Replica *r);
+
+int      shmring_create(ShmRing *r, const char *name, unsigned cap);
+int      shmring_attach(ShmRing *r, const char *name);
+Message* shmring_reserve(ShmRing *r, unsigned long long *ticket);
+void     shmring_commit(ShmRing *r, unsigned long long ticket);
+int      shmring_push(ShmRing *r, const Message *m);
+const Message* shmring_peek(ShmRing *r);
+void     shmring_release(ShmRing *r);
+int      shmring_wait(ShmRing *r, int timeout_ms);
+void     shmring_close(ShmRing *r);
+int      delivery_worker_run(const char *name);
+
+int      app_handoff_save(App *app, const char *name);
+int      app_handoff_attach(App *app, const char *name);
+
+unsigned shard_of(const char *username, int nshards);
+int  shard_serve(App *app, const char *path);
+int  router_run(const char *shard_paths);
+
+UserNode* app_user_find(App *app, const char *username);
+int  app_post_find(App *app, int id, Post *out);
+void app_feed_invalidate(App *app, const char *username);
+void app_feed_render(App *app, GraphUser *gu);
+int  app_rank_feeds(App *app);
+int  app_feed_warm(App *app, int budget);
+int  app_posts_before(App *app, int below_id, Post *out, int max);
+void pager_run(int (*fill)(void *ctx, int max), void *ctx);
+int  app_follow(App *app, const char *from, const char *to);
+int  app_unfollow(App *app, const char *from, const char *to);
+int  app_follow_many(App *app, const char *from, const char *const *to, int n, int follow);
+void txn_begin(Txn *t, App *app);
+int  txn_follow(Txn *t, const char *from, const char *to);
+int  txn_unfollow(Txn *t, const char *from, const char *to);
+int  txn_commit(Txn *t);
+int  snap_pin(App *app, Snapshot *s);
+void snap_release(App *app, Snapshot *s);
+int  snap_user(const App *app, const Snapshot *s, int id, User *out);
+int  snap_following(const App *app, const Snapshot *s, const GraphUser *gu, int (*fn)(void *ctx, const char *name), void *ctx);
+int  app_export_start(App *app, const char *path);
+int  app_export_step(App *app, int budget);
+int  app_apply(App *app, const CdcEvent *ev);
+
 void app_init(App *app);
 void app_free(App *app);
 
@@ -128,16 +794,27 @@ void ui_create_post(App *app);
 void ui_view_posts(App *app);
 void ui_follow(App *app);
 void ui_unfollow(App *app);
+void ui_follow_many(App *app);
+void ui_unfollow_many(App *app);
+void ui_admin_export(App *app);
 void ui_show_following(App *app);
 void ui_show_followers(App *app);
 void ui_send_message(App *app);
 void ui_process_message(App *app);
 void ui_show_messages(App *app);
+void ui_new_posts(App *app);
+void ui_view_feed(App *app);
+void ui_show_mutual(App *app);
+void ui_new_followers(App *app);
 
 void ui_admin_register(App *app);
 void ui_admin_login(App *app);
 void ui_admin_logout(App *app);
 void ui_admin_change_limits(App *app);
+void ui_admin_stats(App *app);
+void ui_admin_analytics(App *app);
+
+int  bench_run(const char *name, long n);
 
 void print_menu(void);
 void print_admin_menu(void);